@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+/*
+ * EPG microbenchmarks, built with -DOCTONET_BENCHMARKS=ON.
+ *
+ *   octonet-benchmark timestamps [count]
+ *     Parses count EPG timestamps, half of them date-times and half
+ *     durations, with OctonetEpg::parseDateTime and with sscanf and
+ *     timegm as before.
+ *
+ *   octonet-benchmark finalize [threads] [events] [channels]
+ *     Sorts and deduplicates events spread over channels of uneven size
+ *     with OctonetEpg::finalize on a WorkerPool of the given number of
+ *     threads, the way loadEPG does.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../src/OctonetEpg.h"
+#include "../src/WorkerPool.h"
+
+#ifdef TARGET_WINDOWS
+#define timegm _mkgmtime
+#define gmtime_r(t, tm) gmtime_s(tm, t)
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(const Clock::time_point &since)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+/* The parser OctonetEpg::parseDateTime replaced */
+static time_t parseDateTimeLibc(const std::string &date)
+{
+	struct tm timeinfo;
+
+	memset(&timeinfo, 0, sizeof(timeinfo));
+	if (date.length() > 8) {
+		sscanf(date.c_str(), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+				&timeinfo.tm_year, &timeinfo.tm_mon, &timeinfo.tm_mday,
+				&timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec);
+		timeinfo.tm_mon -= 1;
+		timeinfo.tm_year -= 1900;
+	} else {
+		sscanf(date.c_str(), "%02d:%02d:%02d",
+				&timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec);
+		timeinfo.tm_year = 70;
+		timeinfo.tm_mday = 1;
+	}
+	timeinfo.tm_isdst = -1;
+
+	return timegm(&timeinfo);
+}
+
+static int benchmarkTimestamps(size_t count)
+{
+	std::vector<std::string> dates;
+	char buf[32];
+
+	dates.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		if (i & 1) {
+			time_t t = 1500000000 + (time_t)i * 977;
+			struct tm timeinfo;
+			gmtime_r(&t, &timeinfo);
+			strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
+		} else {
+			snprintf(buf, sizeof(buf), "%02d:%02d:%02d", (int)(i % 24), (int)(i % 60), (int)(i / 7 % 60));
+		}
+		dates.push_back(buf);
+	}
+
+	for (std::vector<std::string>::const_iterator it = dates.begin(); it != dates.end(); ++it) {
+		if (OctonetEpg::parseDateTime(*it) != parseDateTimeLibc(*it)) {
+			fprintf(stderr, "mismatch for %s\n", it->c_str());
+			return 1;
+		}
+	}
+
+	/* The sums keep the loops from being optimized away */
+	Clock::time_point start = Clock::now();
+	long long sumLibc = 0;
+	for (std::vector<std::string>::const_iterator it = dates.begin(); it != dates.end(); ++it)
+		sumLibc += parseDateTimeLibc(*it);
+	double libcMs = elapsedMs(start);
+
+	start = Clock::now();
+	long long sum = 0;
+	for (std::vector<std::string>::const_iterator it = dates.begin(); it != dates.end(); ++it)
+		sum += OctonetEpg::parseDateTime(*it);
+	double ms = elapsedMs(start);
+
+	printf("%zu timestamps: sscanf+timegm %.1f ms, parseDateTime %.1f ms%s\n",
+			count, libcMs, ms, sum == sumLibc ? "" : " (sums differ)");
+	return 0;
+}
+
+/* Best of a few runs, the data is rebuilt for every run */
+#define FINALIZE_RUNS 5
+
+static void fillChannels(std::vector<OctonetEpg> &epgs, size_t events)
+{
+	OctonetStringRef empty = { 0, 0 };
+	uint32_t seed = 1;
+
+	for (std::vector<OctonetEpg>::iterator it = epgs.begin(); it != epgs.end(); ++it)
+		it->clear();
+
+	/* A few channels carry most events, like a real EPG does */
+	for (size_t i = 0; i < events; i++) {
+		seed = seed * 1103515245 + 12345;
+		size_t channel = (seed >> 8) % epgs.size() * ((seed >> 16) % epgs.size()) / epgs.size();
+		time_t start = 1500000000 + (time_t)(seed % 1000000);
+		epgs[channel].add(start, start + 1800, (int)(seed >> 4), empty, empty);
+	}
+}
+
+static int benchmarkFinalize(unsigned threads, size_t events, size_t channels)
+{
+	std::vector<OctonetEpg> epgs(channels);
+	double best = 0;
+
+	for (int run = 0; run < FINALIZE_RUNS; run++) {
+		fillChannels(epgs, events);
+
+		Clock::time_point start = Clock::now();
+		std::vector<size_t> order;
+		for (size_t i = 0; i < epgs.size(); i++) {
+			if (!epgs[i].empty())
+				order.push_back(i);
+		}
+		std::sort(order.begin(), order.end(), [&epgs](size_t a, size_t b) {
+			return epgs[a].size() > epgs[b].size();
+		});
+
+		WorkerPool::run(order.size(), threads, [&](size_t i) {
+			epgs[order[i]].finalize();
+		});
+
+		double ms = elapsedMs(start);
+		if (run == 0 || ms < best)
+			best = ms;
+	}
+
+	printf("%zu events over %zu channels, %u threads: finalize %.2f ms\n",
+			events, channels, threads, best);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s timestamps [count]\n"
+			"       %s finalize [threads] [events] [channels]\n", name, name);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if (strcmp(argv[1], "timestamps") == 0)
+		return benchmarkTimestamps(argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000);
+
+	if (strcmp(argv[1], "finalize") == 0) {
+		unsigned threads = argc > 2 ? strtoul(argv[2], NULL, 10) : WorkerPool::defaultThreads(8);
+		size_t events = argc > 3 ? strtoul(argv[3], NULL, 10) : 100000;
+		size_t channels = argc > 4 ? strtoul(argv[4], NULL, 10) : 200;
+		if (threads == 0 || channels == 0) {
+			usage(argv[0]);
+			return 2;
+		}
+
+		return benchmarkFinalize(threads, events, channels);
+	}
+
+	usage(argv[0]);
+	return 2;
+}
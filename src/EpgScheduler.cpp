@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include "EpgScheduler.h"
+#include "client.h"
+
+using namespace ADDON;
+
+/* Bounds of the regular refresh interval in seconds */
+#define EPG_REFRESH_MIN 60
+#define EPG_REFRESH_MAX 3600
+/* Upper bound of the retry interval after failed fetches */
+#define EPG_RETRY_MAX 600
+/* How long before a gap or the horizon a refresh is scheduled */
+#define EPG_GAP_MARGIN 60
+#define EPG_HORIZON_MARGIN 3600
+/* Weight of the latest fetch in the change rate */
+#define EPG_CHANGE_WEIGHT 0.3
+
+EpgScheduler::EpgScheduler(void)
+{
+	reset();
+}
+
+void EpgScheduler::reset(void)
+{
+	nextRefresh = 0;
+	changeRate = 1.0;
+	failures = 0;
+	reason = "initial";
+
+	fetches = 0;
+	changed = 0;
+	unchanged = 0;
+	failed = 0;
+	skips = 0;
+}
+
+void EpgScheduler::update(HttpFetchResult result, time_t now, time_t gap, time_t horizon)
+{
+	fetches++;
+
+	if (result == HTTP_FETCH_FAILED) {
+		failed++;
+		failures++;
+
+		int retry = EPG_REFRESH_MIN / 2;
+		for (int i = 1; i < failures && retry < EPG_RETRY_MAX; i++)
+			retry *= 2;
+		if (retry > EPG_RETRY_MAX)
+			retry = EPG_RETRY_MAX;
+
+		nextRefresh = now + retry;
+		reason = "retry";
+		libKodi->Log(LOG_DEBUG, "%s: next epg refresh in %d s (%s)", __func__, retry, reason);
+		return;
+	}
+
+	failures = 0;
+	if (result == HTTP_FETCH_CHANGED)
+		changed++;
+	else
+		unchanged++;
+
+	double sample = result == HTTP_FETCH_CHANGED ? 1.0 : 0.0;
+	changeRate = changeRate * (1.0 - EPG_CHANGE_WEIGHT) + sample * EPG_CHANGE_WEIGHT;
+
+	/* Servers which rarely change are asked less often */
+	time_t next = now + EPG_REFRESH_MAX - (time_t)((EPG_REFRESH_MAX - EPG_REFRESH_MIN) * changeRate);
+	reason = "change rate";
+
+	if (gap > now && gap - EPG_GAP_MARGIN < next) {
+		next = gap - EPG_GAP_MARGIN;
+		reason = "gap";
+	}
+
+	if (horizon > now && horizon - EPG_HORIZON_MARGIN < next) {
+		next = horizon - EPG_HORIZON_MARGIN;
+		reason = "horizon";
+	}
+
+	if (next < now + EPG_REFRESH_MIN)
+		next = now + EPG_REFRESH_MIN;
+
+	nextRefresh = next;
+	libKodi->Log(LOG_DEBUG, "%s: next epg refresh in %d s (%s, change rate %.2f)",
+			__func__, (int)(next - now), reason, changeRate);
+}
+
+void EpgScheduler::logDiagnostics(void) const
+{
+	libKodi->Log(LOG_NOTICE, "diagnostics: epg fetches %zu (%zu changed, %zu unchanged, %zu failed), %zu requests served without fetch",
+			fetches, changed, unchanged, failed, skips.load());
+	libKodi->Log(LOG_NOTICE, "diagnostics: epg change rate %.2f, next refresh in %d s (%s)",
+			changeRate, (int)(nextRefresh.load() - time(NULL)), reason);
+}
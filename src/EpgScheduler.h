@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <atomic>
+#include <stddef.h>
+#include <time.h>
+
+#include "HttpResource.h"
+
+/*
+ * Decides when the EPG has to be fetched again. The next refresh is due
+ * after an interval derived from how often recent fetches actually brought
+ * new data, but earlier if the known data runs out: shortly before the
+ * first channel runs out of events or before the server's data horizon.
+ */
+class EpgScheduler
+{
+	public:
+		EpgScheduler(void);
+
+		bool isDue(time_t now) const { return now >= nextRefresh; }
+		time_t getNextRefresh(void) const { return nextRefresh; }
+
+		/* Called after every fetch attempt. gap and horizon describe the
+		 * EPG that is published after the fetch, 0 if unknown. */
+		void update(HttpFetchResult result, time_t now, time_t gap, time_t horizon);
+
+		/* Called whenever an EPG request is served without fetching */
+		void skipped(void) { skips++; }
+
+		void reset(void);
+		void logDiagnostics(void) const;
+
+	private:
+		/* Read by EPG requests without any lock */
+		std::atomic<time_t> nextRefresh;
+		double changeRate;
+		int failures;
+		const char *reason;
+
+		size_t fetches;
+		size_t changed;
+		size_t unchanged;
+		size_t failed;
+		std::atomic<size_t> skips;
+};
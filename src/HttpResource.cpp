@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include "HttpResource.h"
+#include "Hash.h"
+#include "client.h"
+
+using namespace ADDON;
+
+HttpResource::HttpResource(void)
+{
+	invalidate();
+}
+
+HttpResource::HttpResource(const std::string &url)
+	: url(url)
+{
+	invalidate();
+}
+
+void HttpResource::setUrl(const std::string &url)
+{
+	if (this->url == url)
+		return;
+
+	this->url = url;
+	invalidate();
+}
+
+void HttpResource::invalidate(void)
+{
+	etag.clear();
+	lastModified.clear();
+	contentHash = 0;
+	valid = false;
+}
+
+std::string HttpResource::getHeader(void *f, const char *name)
+{
+	std::string value;
+	char *v = libKodi->GetFilePropertyValue(f, XFILE::FILE_PROPERTY_RESPONSE_HEADER, name);
+	if (v) {
+		value = v;
+		libKodi->FreeString(v);
+	}
+
+	return value;
+}
+
+HttpFetchResult HttpResource::fetch(std::string &content)
+{
+	void *f = libKodi->CURLCreate(url.c_str());
+	if (!f)
+		return HTTP_FETCH_FAILED;
+
+	if (valid && !etag.empty())
+		libKodi->CURLAddOption(f, XFILE::CURL_OPTION_HEADER, "If-None-Match", etag.c_str());
+	if (valid && !lastModified.empty())
+		libKodi->CURLAddOption(f, XFILE::CURL_OPTION_HEADER, "If-Modified-Since", lastModified.c_str());
+
+	if (!libKodi->CURLOpen(f, XFILE::READ_NO_CACHE)) {
+		libKodi->CloseFile(f);
+		return HTTP_FETCH_FAILED;
+	}
+
+	std::string protocol;
+	char *p = libKodi->GetFilePropertyValue(f, XFILE::FILE_PROPERTY_RESPONSE_PROTOCOL, "");
+	if (p) {
+		protocol = p;
+		libKodi->FreeString(p);
+	}
+
+	/* Status line looks like "HTTP/1.1 304 Not Modified" */
+	if (valid && protocol.find(" 304") != std::string::npos) {
+		libKodi->CloseFile(f);
+		libKodi->Log(LOG_DEBUG, "%s: %s not modified", __func__, url.c_str());
+		return HTTP_FETCH_UNCHANGED;
+	}
+
+	std::string body;
+	char buf[1024];
+	while (int read = libKodi->ReadFile(f, buf, 1024))
+		body.append(buf, read);
+
+	std::string newEtag = getHeader(f, "ETag");
+	std::string newLastModified = getHeader(f, "Last-Modified");
+	libKodi->CloseFile(f);
+
+	uint64_t newHash = fnv1a64(body.data(), body.size());
+	bool unchanged = valid && newHash == contentHash;
+
+	etag = newEtag;
+	lastModified = newLastModified;
+	contentHash = newHash;
+	valid = true;
+
+	if (unchanged) {
+		libKodi->Log(LOG_DEBUG, "%s: %s content unchanged", __func__, url.c_str());
+		return HTTP_FETCH_UNCHANGED;
+	}
+
+	content.swap(body);
+	return HTTP_FETCH_CHANGED;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <stdint.h>
+#include <string>
+
+enum HttpFetchResult
+{
+	HTTP_FETCH_FAILED,
+	HTTP_FETCH_UNCHANGED,
+	HTTP_FETCH_CHANGED
+};
+
+/*
+ * A remote document that is revalidated instead of blindly re-downloaded.
+ * The ETag and Last-Modified validators of the last successful response are
+ * sent along with the next request. Servers which send neither are handled
+ * by comparing a hash of the received content with the previous one.
+ */
+class HttpResource
+{
+	public:
+		HttpResource(void);
+		explicit HttpResource(const std::string &url);
+
+		void setUrl(const std::string &url);
+		const std::string& getUrl(void) const { return url; }
+
+		/* Forget all validators, the next fetch reports HTTP_FETCH_CHANGED */
+		void invalidate(void);
+
+		/* content is only filled if HTTP_FETCH_CHANGED is returned */
+		HttpFetchResult fetch(std::string &content);
+
+	private:
+		std::string getHeader(void *f, const char *name);
+
+		std::string url;
+		std::string etag;
+		std::string lastModified;
+		uint64_t contentHash;
+		bool valid;
+};
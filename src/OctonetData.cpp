@@ -20,95 +20,418 @@
  *
  */
 
+#include <algorithm>
+#include <set>
 #include <sstream>
 #include <string>
 
 #include <json/json.h>
 
 #include "OctonetData.h"
+#include "Hash.h"
+#include "WorkerPool.h"
 #include "p8-platform/util/StringUtils.h"
 
-#ifdef __WINDOWS__
-#define timegm _mkgmtime
-#endif
-
 using namespace ADDON;
 
-OctonetData::OctonetData()
+/* Seconds between evictions of events that are over */
+#define EPG_EVICT_INTERVAL 600
+/* How far the window may move before a cut EPG is parsed again */
+#define EPG_WINDOW_SLACK 3600
+/* Seconds between revalidations of the channel list */
+#define CHANNELLIST_REFRESH_INTERVAL 300
+
+OctonetServer::OctonetServer(const std::string &address)
+	: address(address),
+	channelList("http://" + address + "/channellist.lua?select=json"),
+	epg("http://" + address + "/epg.lua?;#|encoding=gzip")
+{
+}
+
+static std::vector<std::string> parseServerList(const std::string &addresses)
+{
+	std::vector<std::string> result;
+	std::string address;
+
+	for (size_t i = 0; i <= addresses.size(); i++) {
+		char c = i < addresses.size() ? addresses[i] : ';';
+		if (c == ';' || c == ',' || c == ' ') {
+			if (!address.empty())
+				result.push_back(address);
+			address.clear();
+		} else {
+			address += c;
+		}
+	}
+
+	return result;
+}
+
+OctonetData::OctonetData(const std::string &addresses, int epgDays)
+	: epgDays(epgDays), nextServer(0)
 {
-	serverAddress = octonetAddress;
-	channels.clear();
-	groups.clear();
-	lastEpgLoad = 0;
+	setServerAddress(addresses);
+	epgCutOff = 0;
+	lastEviction = 0;
+	lastChannelListLoad = 0;
+	channelListRefreshes = 0;
+	channelListUpdates = 0;
+
+	std::shared_ptr<OctonetCatalogue> empty = std::make_shared<OctonetCatalogue>();
+	empty->epgStrings = std::make_shared<OctonetStringArena>();
+	publish(empty);
 
 	if (!loadChannelList())
-		libKodi->QueueNotification(QUEUE_ERROR, libKodi->GetLocalizedString(30001), channels.size());
+		libKodi->QueueNotification(QUEUE_ERROR, libKodi->GetLocalizedString(30001));
+
+	CreateThread(false);
 }
 
 OctonetData::~OctonetData(void)
 {
-	channels.clear();
-	groups.clear();
+	StopThread();
+}
+
+std::shared_ptr<const OctonetCatalogue> OctonetData::getCatalogue(void) const
+{
+	return std::atomic_load(&catalogue);
+}
+
+void OctonetData::publish(const std::shared_ptr<const OctonetCatalogue> &catalogue)
+{
+	std::atomic_store(&this->catalogue, catalogue);
+}
+
+int64_t OctonetData::parseID(const std::string &id)
+{
+	return (int64_t)fnv1a64(id.data(), id.size());
 }
 
-int64_t OctonetData::parseID(std::string id)
+/* Kodi keys its channel database, EPG and watch history by the unique id,
+ * so it has to survive reordering on the server and addon updates */
+static int uniqueIdFromNativeId(int64_t nativeId)
 {
-	std::hash<std::string> hash_fn;
-	int64_t nativeId = hash_fn(id);
+	uint64_t h = (uint64_t)nativeId;
+	int id = (int)((h ^ (h >> 32)) & 0x7fffffff);
 
-	return nativeId;
+	return id != 0 ? id : 1;
 }
 
-bool OctonetData::loadChannelList()
+static void assignUniqueIds(std::vector<OctonetChannel> &channels, const OctonetCatalogue &old)
 {
-	std::string jsonContent;
-	void *f = libKodi->OpenFile(("http://" + serverAddress + "/channellist.lua?select=json").c_str(), 0);
-	if (!f)
+	std::set<int> used;
+	std::vector<bool> assigned(channels.size(), false);
+
+	/* Known channels keep their id, even if it was moved on a collision */
+	for (size_t i = 0; i < channels.size(); i++) {
+		const OctonetChannel *known = old.findChannelByNativeId(channels[i].nativeId);
+		if (known != NULL && used.insert(known->id).second) {
+			channels[i].id = known->id;
+			assigned[i] = true;
+		}
+	}
+
+	/* The rest goes by native id rather than list order, so a restart
+	 * hands out the same ids however the server orders its list */
+	std::vector<size_t> order;
+	for (size_t i = 0; i < channels.size(); i++) {
+		if (!assigned[i])
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&channels](size_t a, size_t b) {
+		return channels[a].nativeId < channels[b].nativeId;
+	});
+
+	/* Channels whose id is free take it before any collision is moved,
+	 * so a moved id never displaces another channel */
+	for (std::vector<size_t>::const_iterator it = order.begin(); it != order.end(); ++it) {
+		int id = uniqueIdFromNativeId(channels[*it].nativeId);
+		if (used.insert(id).second) {
+			channels[*it].id = id;
+			assigned[*it] = true;
+		}
+	}
+
+	for (std::vector<size_t>::const_iterator it = order.begin(); it != order.end(); ++it) {
+		if (assigned[*it])
+			continue;
+
+		int id = uniqueIdFromNativeId(channels[*it].nativeId);
+		libKodi->Log(LOG_DEBUG, "%s: unique id collision for %s", __func__, channels[*it].name.c_str());
+		while (!used.insert(id).second) {
+			id = (id + 1) & 0x7fffffff;
+			if (id == 0)
+				id = 1;
+		}
+		channels[*it].id = id;
+	}
+}
+
+static bool groupEquals(const OctonetGroup &a, const OctonetCatalogue &ca, const OctonetGroup &b, const OctonetCatalogue &cb)
+{
+	if (a.radio != b.radio || a.members.size() != b.members.size())
 		return false;
 
-	char buf[1024];
-	while (int read = libKodi->ReadFile(f, buf, 1024))
-		jsonContent.append(buf, read);
+	for (size_t i = 0; i < a.members.size(); i++) {
+		if (ca.channels[a.members[i]].id != cb.channels[b.members[i]].id)
+			return false;
+	}
+
+	return true;
+}
+
+OctonetCatalogueDiff::OctonetCatalogueDiff(const OctonetCatalogue &from, const OctonetCatalogue &to)
+{
+	channelsAdded = channelsRemoved = channelsChanged = 0;
+	groupsAdded = groupsRemoved = groupsChanged = 0;
+
+	for (size_t i = 0; i < to.channels.size(); i++) {
+		const OctonetChannel &chan = to.channels[i];
+		const OctonetChannel *prev = from.findChannel(chan.id);
+
+		if (prev == NULL)
+			channelsAdded++;
+		/* The channel number is the position in the list */
+		else if (prev->name != chan.name || prev->urls != chan.urls || prev->radio != chan.radio ||
+				prev - &from.channels[0] != (ptrdiff_t)i)
+			channelsChanged++;
+	}
+	for (std::vector<OctonetChannel>::const_iterator it = from.channels.begin(); it != from.channels.end(); ++it) {
+		if (to.findChannel(it->id) == NULL)
+			channelsRemoved++;
+	}
+
+	for (std::vector<OctonetGroup>::const_iterator it = to.groups.begin(); it != to.groups.end(); ++it) {
+		const OctonetGroup *prev = from.findGroup(it->name);
+
+		if (prev == NULL)
+			groupsAdded++;
+		else if (!groupEquals(*prev, from, *it, to))
+			groupsChanged++;
+	}
+	for (std::vector<OctonetGroup>::const_iterator it = from.groups.begin(); it != from.groups.end(); ++it) {
+		if (to.findGroup(it->name) == NULL)
+			groupsRemoved++;
+	}
+}
+
+static bool onlyServedBy(const OctonetChannel &channel, const std::vector<std::string> &prefixes)
+{
+	if (prefixes.empty())
+		return false;
+
+	for (std::vector<std::string>::const_iterator url = channel.urls.begin(); url != channel.urls.end(); ++url) {
+		bool found = false;
+		for (std::vector<std::string>::const_iterator it = prefixes.begin(); it != prefixes.end(); ++it)
+			found = found || url->compare(0, it->size(), *it) == 0;
+		if (!found)
+			return false;
+	}
+
+	return true;
+}
+
+HttpFetchResult OctonetData::fetchAll(HttpResource OctonetServer::*resource, std::string OctonetServer::*cache,
+		std::vector<std::string> &contents, size_t &failures)
+{
+	std::vector<HttpFetchResult> results(servers.size());
+	contents.assign(servers.size(), std::string());
+
+	WorkerPool::run(servers.size(), servers.size(), [&](size_t i) {
+		results[i] = (servers[i].*resource).fetch(contents[i]);
+	});
+
+	bool changed = false;
+	failures = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i] == HTTP_FETCH_CHANGED)
+			changed = true;
+		else if (results[i] == HTTP_FETCH_FAILED)
+			failures++;
+	}
+
+	if (failures == servers.size())
+		return HTTP_FETCH_FAILED;
+	if (!changed)
+		return HTTP_FETCH_UNCHANGED;
+
+	/* Merged results need the content of every server. Unchanged ones
+	 * come from the cache, only a server without one is fetched again */
+	WorkerPool::run(servers.size(), servers.size(), [&](size_t i) {
+		if (results[i] != HTTP_FETCH_UNCHANGED)
+			return;
+
+		if (!(servers[i].*cache).empty()) {
+			contents[i] = servers[i].*cache;
+			return;
+		}
+
+		(servers[i].*resource).invalidate();
+		results[i] = (servers[i].*resource).fetch(contents[i]);
+	});
+
+	if (servers.size() > 1) {
+		for (size_t i = 0; i < servers.size(); i++) {
+			if (results[i] == HTTP_FETCH_CHANGED)
+				servers[i].*cache = contents[i];
+		}
+	}
+
+	failures = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i] == HTTP_FETCH_FAILED)
+			failures++;
+	}
+
+	return HTTP_FETCH_CHANGED;
+}
+
+bool OctonetData::loadChannelList(bool notify)
+{
+	P8PLATFORM::CLockObject lock(updateMutex);
+
+	lastChannelListLoad = time(NULL);
+	channelListRefreshes++;
 
-	libKodi->CloseFile(f);
+	std::vector<std::string> contents;
+	size_t failures;
+	switch (fetchAll(&OctonetServer::channelList, &OctonetServer::channelListContent, contents, failures)) {
+	case HTTP_FETCH_FAILED:
+		return false;
+	case HTTP_FETCH_UNCHANGED:
+		return true;
+	case HTTP_FETCH_CHANGED:
+		break;
+	}
 
-	Json::Value root;
-	Json::Reader reader;
+	std::shared_ptr<const OctonetCatalogue> old = getCatalogue();
 
-	if (!reader.parse(jsonContent, root, false))
+	/* Channels of a missing server would be removed from Kodi, rather
+	 * keep the old list until all servers answer again */
+	if (failures > 0 && !old->channels.empty()) {
+		for (std::vector<OctonetServer>::iterator it = servers.begin(); it != servers.end(); ++it)
+			it->channelList.invalidate();
 		return false;
+	}
+
+	std::shared_ptr<OctonetCatalogue> cat = std::make_shared<OctonetCatalogue>();
+	std::vector<OctonetChannel> &channels = cat->channels;
+	cat->epgStrings = old->epgStrings;
+
+	for (size_t s = 0; s < servers.size(); s++) {
+		Json::Value root;
+		Json::Reader reader;
 
-	const Json::Value groupList = root["GroupList"];
-	for (unsigned int i = 0; i < groupList.size(); i++) {
-		const Json::Value channelList = groupList[i]["ChannelList"];
-		OctonetGroup group;
+		if (contents[s].empty())
+			continue;
 
-		group.name = groupList[i]["Title"].asString();
-		group.radio = group.name.compare(0, 5, "Radio") ? false : true;
+		if (!reader.parse(contents[s], root, false)) {
+			libKodi->Log(LOG_ERROR, "%s: invalid channel list from %s", __func__, servers[s].address.c_str());
+			for (std::vector<OctonetServer>::iterator it = servers.begin(); it != servers.end(); ++it)
+				it->channelList.invalidate();
+			if (!old->channels.empty())
+				return false;
+			continue;
+		}
 
-		for (unsigned int j = 0; j < channelList.size(); j++) {
-			const Json::Value channel = channelList[j];
-			OctonetChannel chan;
+		const Json::Value groupList = root["GroupList"];
+		for (unsigned int i = 0; i < groupList.size(); i++) {
+			const Json::Value channelList = groupList[i]["ChannelList"];
+			std::string name = groupList[i]["Title"].asString();
 
-			chan.name = channel["Title"].asString();
-			chan.url = "rtsp://" + serverAddress + "/" + channel["Request"].asString();
-			chan.radio = group.radio;
-			chan.nativeId = parseID(channel["ID"].asString());
+			/* Groups of the same name are merged */
+			OctonetGroup *group = NULL;
+			for (std::vector<OctonetGroup>::iterator it = cat->groups.begin(); it != cat->groups.end(); ++it) {
+				if (it->name == name)
+					group = &*it;
+			}
+			if (group == NULL) {
+				cat->groups.push_back(OctonetGroup());
+				group = &cat->groups.back();
+				group->name = name;
+				group->radio = name.compare(0, 5, "Radio") ? false : true;
+			}
 
-			chan.id = 1000 + channels.size();
-			group.members.push_back(channels.size());
-			channels.push_back(chan);
+			for (unsigned int j = 0; j < channelList.size(); j++) {
+				const Json::Value channel = channelList[j];
+				int64_t nativeId = parseID(channel["ID"].asString());
+				std::string url = "rtsp://" + servers[s].address + "/" + channel["Request"].asString();
+
+				/* A channel listed in several groups or on several
+				 * servers is only added once */
+				size_t index;
+				const OctonetChannel *dup = cat->findChannelByNativeId(nativeId);
+				if (dup != NULL) {
+					index = dup - &channels[0];
+					std::vector<std::string> &urls = channels[index].urls;
+					if (std::find(urls.begin(), urls.end(), url) == urls.end())
+						urls.push_back(url);
+				} else {
+					OctonetChannel chan;
+
+					chan.nativeId = nativeId;
+					chan.name = channel["Title"].asString();
+					chan.urls.push_back(url);
+					chan.radio = group->radio;
+
+					/* Keep the EPG of channels we already know */
+					const OctonetChannel *known = old->findChannelByNativeId(chan.nativeId);
+					chan.epg = known != NULL ? known->epg : std::make_shared<OctonetEpg>();
+
+					index = channels.size();
+					channels.push_back(chan);
+				}
+
+				if (std::find(group->members.begin(), group->members.end(), (int)index) == group->members.end())
+					group->members.push_back(index);
+			}
 		}
-		groups.push_back(group);
+	}
+
+	assignUniqueIds(channels, *old);
+
+	OctonetCatalogueDiff diff(*old, *cat);
+	libKodi->Log(diff.channels() || diff.groups() ? LOG_INFO : LOG_DEBUG,
+			"%s: channels +%zu -%zu ~%zu, groups +%zu -%zu ~%zu", __func__,
+			diff.channelsAdded, diff.channelsRemoved, diff.channelsChanged,
+			diff.groupsAdded, diff.groupsRemoved, diff.groupsChanged);
+
+	if (!diff.channels() && !diff.groups())
+		return true;
+
+	publish(cat);
+	channelListUpdates++;
+
+	/* Events of new channels were dropped by the last EPG load */
+	if (diff.channelsAdded > 0) {
+		for (std::vector<OctonetServer>::iterator it = servers.begin(); it != servers.end(); ++it)
+			it->epg.invalidate();
+		epgScheduler.reset();
+	}
+
+	if (notify) {
+		if (diff.channels())
+			pvr->TriggerChannelUpdate();
+		if (diff.groups())
+			pvr->TriggerChannelGroupsUpdate();
 	}
 
 	return true;
 }
 
-OctonetChannel* OctonetData::findChannel(int64_t nativeId)
+const OctonetChannel* OctonetCatalogue::findChannel(int id) const
 {
-	std::vector<OctonetChannel>::iterator it;
-	for (it = channels.begin(); it < channels.end(); ++it) {
+	for (std::vector<OctonetChannel>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+		if (it->id == id)
+			return &*it;
+	}
+
+	return NULL;
+}
+
+const OctonetChannel* OctonetCatalogue::findChannelByNativeId(int64_t nativeId) const
+{
+	for (std::vector<OctonetChannel>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
 		if (it->nativeId == nativeId)
 			return &*it;
 	}
@@ -116,100 +439,366 @@ OctonetChannel* OctonetData::findChannel(int64_t nativeId)
 	return NULL;
 }
 
-time_t OctonetData::parseDateTime(std::string date)
+const OctonetGroup* OctonetCatalogue::findGroup(const std::string &name) const
+{
+	for (std::vector<OctonetGroup>::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+		if (it->name == name)
+			return &*it;
+	}
+
+	return NULL;
+}
+
+/* Earliest time at which any channel runs out of data, and the time up to
+ * which the server provides any data at all */
+static void getEpgCoverage(const OctonetCatalogue &cat, time_t now, time_t &gap, time_t &horizon)
 {
-	struct tm timeinfo;
+	gap = 0;
+	horizon = 0;
 
-	memset(&timeinfo, 0, sizeof(timeinfo));
+	for (std::vector<OctonetChannel>::const_iterator it = cat.channels.begin(); it != cat.channels.end(); ++it) {
+		const OctonetEpg &epg = *it->epg;
+		if (epg.empty())
+			continue;
 
-	if (date.length() > 8) {
-		sscanf(date.c_str(), "%04d-%02d-%02dT%02d:%02d:%02dZ",
-				&timeinfo.tm_year, &timeinfo.tm_mon, &timeinfo.tm_mday,
-				&timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec);
-		timeinfo.tm_mon -= 1;
-		timeinfo.tm_year -= 1900;
-	} else {
-		sscanf(date.c_str(), "%02d:%02d:%02d",
-				&timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec);
-		timeinfo.tm_year = 70; // unix timestamps start 1970
-		timeinfo.tm_mday = 1;
+		/* Holes between events are the server's business, a refresh
+		 * does not fill them. Only running out of events does */
+		time_t end = *std::max_element(epg.end.begin(), epg.end.end());
+		if (end <= now)
+			continue;
+
+		if (gap == 0 || end < gap)
+			gap = end;
+		if (end > horizon)
+			horizon = end;
 	}
+}
+
+static bool epgEquals(const OctonetEpg &a, const OctonetEpg &b)
+{
+	if (a.size() != b.size())
+		return false;
 
-	timeinfo.tm_isdst = -1;
+	for (size_t j = 0; j < a.size(); j++) {
+		/* The pool hands out the same offset for the same string until it
+		 * is compacted, so comparing references is enough */
+		if (a.start[j] != b.start[j] || a.end[j] != b.end[j] || a.id[j] != b.id[j] ||
+				a.title[j].offset != b.title[j].offset || a.subtitle[j].offset != b.subtitle[j].offset)
+			return false;
+	}
 
-	return timegm(&timeinfo);
+	return true;
 }
 
-bool OctonetData::loadEPG(void)
+bool OctonetData::loadEPG(bool notify)
 {
-	/* Reload at most every 30 seconds */
-	if (lastEpgLoad + 30 > time(NULL))
+	P8PLATFORM::CLockObject lock(updateMutex);
+
+	time_t now = time(NULL);
+	time_t gap, horizon;
+
+	if (!epgScheduler.isDue(now))
 		return false;
 
-	std::string jsonContent;
-	void *f = libKodi->OpenFile(("http://" + serverAddress + "/epg.lua?;#|encoding=gzip").c_str(), 0);
-	if (!f)
+	/* The server may report no change, but events that were outside of
+	 * the window last time might have moved into it by now */
+	time_t windowEnd = getEpgWindowEnd(now);
+	if (epgCutOff != 0 && (windowEnd == 0 || windowEnd > epgCutOff + EPG_WINDOW_SLACK)) {
+		for (std::vector<OctonetServer>::iterator it = servers.begin(); it != servers.end(); ++it)
+			it->epg.invalidate();
+	}
+
+	std::vector<std::string> contents;
+	size_t failures;
+	HttpFetchResult result = fetchAll(&OctonetServer::epg, &OctonetServer::epgContent, contents, failures);
+	switch (result) {
+	case HTTP_FETCH_FAILED:
+		epgScheduler.update(result, now, 0, 0);
 		return false;
+	case HTTP_FETCH_UNCHANGED:
+		/* Nothing changed on the server, keep the parsed EPG */
+		getEpgCoverage(*getCatalogue(), now, gap, horizon);
+		epgScheduler.update(result, now, gap, horizon);
+		return false;
+	case HTTP_FETCH_CHANGED:
+		break;
+	}
 
-	char buf[1024];
-	while (int read = libKodi->ReadFile(f, buf, 1024))
-		jsonContent.append(buf, read);
+	/* Events are collected per channel first and only published once
+	 * post-processing is done */
+	std::shared_ptr<const OctonetCatalogue> old = getCatalogue();
+	std::shared_ptr<OctonetCatalogue> cat = std::make_shared<OctonetCatalogue>(*old);
+	std::vector<OctonetChannel> &channels = cat->channels;
+	std::vector<OctonetEpg> epgs(channels.size());
+	epgStrings.beginUpdate();
+	epgCutOff = 0;
+
+	std::vector<std::string> missing;
+	for (size_t s = 0; s < servers.size(); s++) {
+		Json::Value root;
+		Json::Reader reader;
+
+		/* A server which did not answer is refetched in full next time */
+		if (contents[s].empty() || !reader.parse(contents[s], root, false)) {
+			servers[s].epg.invalidate();
+			missing.push_back("rtsp://" + servers[s].address + "/");
+			libKodi->Log(LOG_ERROR, "%s: no epg from %s", __func__, servers[s].address.c_str());
+			continue;
+		}
 
-	libKodi->CloseFile(f);
+		const Json::Value eventList = root["EventList"];
+		const OctonetChannel *channel = NULL;
+		for (unsigned int i = 0; i < eventList.size(); i++) {
+			const Json::Value &event = eventList[i];
 
-	Json::Value root;
-	Json::Reader reader;
+			std::string channelId = event["ID"].asString();
+			std::string epgId = channelId.substr(channelId.rfind(":") + 1);
+			channelId = channelId.substr(0, channelId.rfind(":"));
 
-	if (!reader.parse(jsonContent, root, false))
-		return false;
+			int64_t nativeId = parseID(channelId);
+			if (channel == NULL || channel->nativeId != nativeId)
+				channel = cat->findChannelByNativeId(nativeId);
 
-	const Json::Value eventList = root["EventList"];
-	OctonetChannel *channel = NULL;
-	for (unsigned int i = 0; i < eventList.size(); i++) {
-		const Json::Value event = eventList[i];
-		OctonetEpgEntry entry;
+			if (channel == NULL) {
+				libKodi->Log(LOG_ERROR, "EPG for unknown channel.");
+				continue;
+			}
 
-		entry.start = parseDateTime(event["Time"].asString());
-		entry.end = entry.start + parseDateTime(event["Duration"].asString());
-		entry.title = event["Name"].asString();
-		entry.subtitle = event["Text"].asString();
-		std::string channelId = event["ID"].asString();
-		std::string epgId = channelId.substr(channelId.rfind(":") + 1);
-		channelId = channelId.substr(0, channelId.rfind(":"));
+			time_t start = OctonetEpg::parseDateTime(event["Time"].asString());
+			time_t end = start + OctonetEpg::parseDateTime(event["Duration"].asString());
 
-		entry.channelId = parseID(channelId);
-		entry.id = atoi(epgId.c_str());
+			/* Only keep what Kodi is able to show */
+			if (end <= now)
+				continue;
+			if (windowEnd != 0 && start > windowEnd) {
+				epgCutOff = windowEnd;
+				continue;
+			}
 
-		if (channel == NULL || channel->nativeId != entry.channelId)
-			channel = findChannel(entry.channelId);
+			epgs[channel - &channels[0]].add(start, end, atoi(epgId.c_str()),
+					epgStrings.intern(event["Name"].asString()),
+					epgStrings.intern(event["Text"].asString()));
+		}
+	}
 
-		if (channel == NULL) {
-			libKodi->Log(LOG_ERROR, "EPG for unknown channel.");
+	/* Channels only offered by servers without an EPG keep their events.
+	 * Interning them again keeps their strings alive and remaps them with
+	 * everything else if the pool gets compacted */
+	for (size_t i = 0; i < channels.size(); i++) {
+		if (!epgs[i].empty() || !onlyServedBy(channels[i], missing))
 			continue;
+
+		const OctonetEpg &epg = *channels[i].epg;
+		for (size_t j = 0; j < epg.size(); j++) {
+			epgs[i].add(epg.start[j], epg.end[j], epg.id[j],
+					epgStrings.intern(std::string(epgStrings.get(epg.title[j]), epg.title[j].length)),
+					epgStrings.intern(std::string(epgStrings.get(epg.subtitle[j]), epg.subtitle[j].length)));
 		}
+	}
+
+	bool compacted = epgStrings.needsCompaction();
+	if (compacted)
+		epgStrings.compact();
+
+	/* Per channel work is independent, largest channels go first */
+	std::vector<size_t> order;
+	for (size_t i = 0; i < epgs.size(); i++) {
+		if (!epgs[i].empty())
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&epgs](size_t a, size_t b) {
+		return epgs[a].size() > epgs[b].size();
+	});
+
+	const OctonetStringPool &strings = epgStrings;
+	WorkerPool::run(order.size(), WorkerPool::defaultThreads(), [&](size_t i) {
+		OctonetEpg &epg = epgs[order[i]];
+		if (compacted) {
+			for (size_t j = 0; j < epg.size(); j++) {
+				epg.title[j] = strings.remap(epg.title[j]);
+				epg.subtitle[j] = strings.remap(epg.subtitle[j]);
+			}
+		}
+		epg.finalize();
+	});
+
+	std::vector<int> changedChannels;
+	for (size_t i = 0; i < channels.size(); i++) {
+		/* Unchanged channels keep sharing the EPG of the old catalogue */
+		if (epgEquals(*channels[i].epg, epgs[i]))
+			continue;
 
-		channel->epg.push_back(entry);
+		std::shared_ptr<OctonetEpg> epg = std::make_shared<OctonetEpg>();
+		epg->swap(epgs[i]);
+		channels[i].epg = epg;
+		changedChannels.push_back(channels[i].id);
+	}
+	cat->epgStrings = epgStrings.snapshot();
+
+	size_t epgBytes = epgStrings.getStats().memoryUsage;
+	size_t epgEvents = 0;
+	for (std::vector<OctonetChannel>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
+		epgBytes += it->epg->memoryUsage();
+		epgEvents += it->epg->size();
+	}
+	libKodi->Log(LOG_DEBUG, "%s: %zu events, %zu bytes", __func__, epgEvents, epgBytes);
+
+	publish(cat);
+
+	getEpgCoverage(*cat, now, gap, horizon);
+	epgScheduler.update(result, now, gap, horizon);
+	libKodi->Log(LOG_DEBUG, "%s: epg changed for %zu channels", __func__, changedChannels.size());
+
+	if (notify) {
+		for (std::vector<int>::const_iterator it = changedChannels.begin(); it != changedChannels.end(); ++it)
+			pvr->TriggerEpgUpdate(*it);
 	}
 
-	lastEpgLoad = time(NULL);
 	return true;
 }
 
+void OctonetData::setServerAddress(const std::string &addresses)
+{
+	P8PLATFORM::CLockObject lock(updateMutex);
+
+	if (addresses == serverAddresses && !servers.empty())
+		return;
+
+	libKodi->Log(LOG_INFO, "%s: using %s", __func__, addresses.c_str());
+
+	{
+		P8PLATFORM::CLockObject addressLock(addressMutex);
+		if (addressHistory.empty() || addressHistory.back() != addresses)
+			addressHistory.push_back(addresses);
+	}
+
+	serverAddresses = addresses;
+	std::vector<std::string> list = parseServerList(addresses);
+	servers.clear();
+	for (std::vector<std::string>::const_iterator it = list.begin(); it != list.end(); ++it)
+		servers.push_back(OctonetServer(*it));
+	tuners.setServers(list);
+
+	/* Picked up by the background thread within a second */
+	lastChannelListLoad = 0;
+	epgScheduler.reset();
+}
+
+const char* OctonetData::getServerAddress(void) const
+{
+	P8PLATFORM::CLockObject lock(addressMutex);
+	return addressHistory.empty() ? "" : addressHistory.back().c_str();
+}
+
+time_t OctonetData::getEpgWindowEnd(time_t now) const
+{
+	int days = epgDays;
+	if (days == EPG_TIMEFRAME_UNLIMITED)
+		return 0;
+
+	return now + (time_t)days * 24 * 60 * 60;
+}
+
+void OctonetData::setEpgTimeFrame(int days)
+{
+	int oldDays = epgDays.exchange(days);
+	if (oldDays == days)
+		return;
+
+	libKodi->Log(LOG_DEBUG, "%s: epg time frame %d days", __func__, days);
+
+	P8PLATFORM::CLockObject lock(updateMutex);
+
+	/* A larger window needs the events that were cut off */
+	if (epgCutOff != 0 && (days == EPG_TIMEFRAME_UNLIMITED ||
+				(oldDays != EPG_TIMEFRAME_UNLIMITED && days > oldDays))) {
+		for (std::vector<OctonetServer>::iterator it = servers.begin(); it != servers.end(); ++it)
+			it->epg.invalidate();
+		epgScheduler.reset();
+	}
+
+	evictEPG(time(NULL));
+}
+
+/* Drop events which are over or beyond the window from the published
+ * catalogue, strings are reclaimed with the next compaction of the pool */
+void OctonetData::evictEPG(time_t now)
+{
+	P8PLATFORM::CLockObject lock(updateMutex);
+
+	std::shared_ptr<const OctonetCatalogue> old = getCatalogue();
+	std::shared_ptr<OctonetCatalogue> cat;
+	time_t windowEnd = getEpgWindowEnd(now);
+	size_t evicted = 0;
+
+	lastEviction = now;
+
+	for (size_t i = 0; i < old->channels.size(); i++) {
+		const OctonetEpg &epg = *old->channels[i].epg;
+
+		size_t first = 0;
+		while (first < epg.size() && epg.end[first] <= now)
+			first++;
+
+		size_t last = epg.size();
+		while (windowEnd != 0 && last > first && epg.start[last - 1] > windowEnd)
+			last--;
+
+		if (first == 0 && last == epg.size())
+			continue;
+
+		if (!cat)
+			cat = std::make_shared<OctonetCatalogue>(*old);
+
+		std::shared_ptr<OctonetEpg> trimmed = std::make_shared<OctonetEpg>();
+		for (size_t j = first; j < last; j++)
+			trimmed->add(epg.start[j], epg.end[j], epg.id[j], epg.title[j], epg.subtitle[j]);
+		cat->channels[i].epg = trimmed;
+
+		evicted += epg.size() - trimmed->size();
+		if (windowEnd != 0 && last != epg.size())
+			epgCutOff = windowEnd;
+	}
+
+	if (cat) {
+		publish(cat);
+		libKodi->Log(LOG_DEBUG, "%s: evicted %zu events", __func__, evicted);
+	}
+}
+
 void *OctonetData::Process(void)
 {
+	while (!IsStopped()) {
+		time_t now = time(NULL);
+
+		if (now >= lastChannelListLoad + CHANNELLIST_REFRESH_INTERVAL)
+			loadChannelList(true);
+		else if (epgScheduler.isDue(now))
+			loadEPG(true);
+		else if (now >= lastEviction + EPG_EVICT_INTERVAL)
+			evictEPG(now);
+
+		if (tuners.isDue(now))
+			tuners.poll(now);
+
+		Sleep(1000);
+	}
+
 	return NULL;
 }
 
 int OctonetData::getChannelCount(void)
 {
-	return channels.size();
+	return getCatalogue()->channels.size();
 }
 
 PVR_ERROR OctonetData::getChannels(ADDON_HANDLE handle, bool bRadio)
 {
-	for (unsigned int i = 0; i < channels.size(); i++)
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+
+	for (unsigned int i = 0; i < cat->channels.size(); i++)
 	{
-		OctonetChannel &channel = channels.at(i);
+		const OctonetChannel &channel = cat->channels.at(i);
 		if (channel.radio == bRadio)
 		{
 			PVR_CHANNEL chan;
@@ -230,96 +819,198 @@ PVR_ERROR OctonetData::getChannels(ADDON_HANDLE handle, bool bRadio)
 
 PVR_ERROR OctonetData::getEPG(ADDON_HANDLE handle, const PVR_CHANNEL &channel, time_t start, time_t end)
 {
-	for (unsigned int i = 0; i < channels.size(); i++)
-	{
-		OctonetChannel &chan = channels.at(i);
-		if (channel.iUniqueId != chan.id)
-			continue;
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+	const OctonetChannel *chan = cat->findChannel(channel.iUniqueId);
+	if (chan == NULL)
+		return PVR_ERROR_NO_ERROR;
+
+	if (!epgScheduler.isDue(time(NULL))) {
+		epgScheduler.skipped();
+	} else if (loadEPG()) {
+		cat = getCatalogue();
+		chan = cat->findChannel(channel.iUniqueId);
+		if (chan == NULL)
+			return PVR_ERROR_NO_ERROR;
+	}
 
-		if(chan.epg.empty()) {
-			loadEPG();
-		}
+	const OctonetEpg &epg = *chan->epg;
+	const OctonetStringArena &strings = *cat->epgStrings;
+
+	/* Windows around the current time start at the now cursor */
+	time_t now = time(NULL);
+	size_t first;
+	if (start <= now && now <= end) {
+		first = epg.findCurrent(now);
+		while (first > 0 && epg.end[first - 1] >= start)
+			first--;
+	} else {
+		first = epg.find(start - 1);
+	}
 
-		// FIXME: Check if reload is needed!?
+	for (size_t j = first; j < epg.size(); j++) {
+		if (epg.start[j] > end)
+			break;
+		if (epg.end[j] < start)
+			continue;
 
-		std::vector<OctonetEpgEntry>::iterator it;
-		time_t last_end = 0;
-		for (it = chan.epg.begin(); it != chan.epg.end(); ++it) {
-			if (it->end > last_end)
-				last_end = it->end;
+		EPG_TAG entry;
+		memset(&entry, 0, sizeof(EPG_TAG));
 
-			if (it->end < start || it->start > end) {
-				continue;
-			}
+		entry.iUniqueChannelId = chan->id;
+		entry.iUniqueBroadcastId = epg.id[j];
+		entry.strTitle = strings.get(epg.title[j]);
+		entry.strPlotOutline = strings.get(epg.subtitle[j]);
+		entry.startTime = epg.start[j];
+		entry.endTime = epg.end[j];
 
-			EPG_TAG entry;
-			memset(&entry, 0, sizeof(EPG_TAG));
+		pvr->TransferEpgEntry(handle, &entry);
+	}
 
-			entry.iUniqueChannelId = chan.id;
-			entry.iUniqueBroadcastId = it->id;
-			entry.strTitle = it->title.c_str();
-			entry.strPlotOutline = it->subtitle.c_str();
-			entry.startTime = it->start;
-			entry.endTime = it->end;
+	return PVR_ERROR_NO_ERROR;
+}
 
-			pvr->TransferEpgEntry(handle, &entry);
-		}
+static std::string serverOfUrl(const std::string &url)
+{
+	/* Stream URLs are built as rtsp://<address>/<request> */
+	size_t begin = url.find("://");
+	if (begin == std::string::npos)
+		return std::string();
+	begin += 3;
 
-		if (last_end < end)
-			loadEPG();
+	return url.substr(begin, url.find('/', begin) - begin);
+}
 
-		for (it = chan.epg.begin(); it != chan.epg.end(); ++it) {
-			if (it->end < start || it->start > end) {
-				continue;
-			}
+std::vector<std::string> OctonetData::getUrls(int id) const {
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+	const OctonetChannel *chan = cat->findChannel(id);
 
-			EPG_TAG entry;
-			memset(&entry, 0, sizeof(EPG_TAG));
+	return chan != NULL ? chan->urls : std::vector<std::string>();
+}
 
-			entry.iUniqueChannelId = chan.id;
-			entry.iUniqueBroadcastId = it->id;
-			entry.strTitle = it->title.c_str();
-			entry.strPlotOutline = it->subtitle.c_str();
-			entry.startTime = it->start;
-			entry.endTime = it->end;
+std::vector<std::string> OctonetData::admitUrls(const std::vector<std::string> &urls) {
+	std::vector<std::string> result;
+
+	if (urls.empty())
+		return result;
+
+	/* Servers with free tuners first, then those we know nothing about.
+	 * Servers offering a channel equally well are used round robin. */
+	std::vector<std::pair<int, std::string> > candidates;
+	unsigned int first = nextServer++;
+	for (size_t i = 0; i < urls.size(); i++) {
+		const std::string &url = urls[(first + i) % urls.size()];
+		std::string address = serverOfUrl(url);
+
+		/* The last answer may be outdated, ask again before giving up */
+		int available = tuners.getFree(address);
+		if (available == 0) {
+			tuners.refresh(address);
+			available = tuners.getFree(address);
+		}
 
-			pvr->TransferEpgEntry(handle, &entry);
+		if (available == 0) {
+			libKodi->Log(LOG_INFO, "%s: no free tuner on %s", __func__, address.c_str());
+			continue;
 		}
+
+		candidates.push_back(std::make_pair(available > 0 ? 0 : 1, url));
 	}
 
-	return PVR_ERROR_NO_ERROR;
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[](const std::pair<int, std::string> &a, const std::pair<int, std::string> &b) {
+			return a.first < b.first;
+		});
+	for (size_t i = 0; i < candidates.size(); i++)
+		result.push_back(candidates[i].second);
+
+	return result;
 }
 
-const std::string& OctonetData::getUrl(int id) const {
-	for(std::vector<OctonetChannel>::const_iterator iter = channels.begin(); iter != channels.end(); ++iter) {
-		if(iter->id == id) {
-			return iter->url;
+static std::string urlParameter(const std::string &url, const std::string &name)
+{
+	size_t pos = url.find('?');
+	while (pos != std::string::npos) {
+		pos++;
+		if (url.compare(pos, name.size() + 1, name + "=") == 0) {
+			pos += name.size() + 1;
+			return url.substr(pos, url.find('&', pos) - pos);
 		}
+		pos = url.find('&', pos);
 	}
 
-	return channels[0].url;
+	return std::string();
 }
 
-const std::string& OctonetData::getName(int id) const {
-	for(std::vector<OctonetChannel>::const_iterator iter = channels.begin(); iter != channels.end(); ++iter) {
-		if(iter->id == id) {
-			return iter->name;
-		}
-	}
+int OctonetData::pickFrontend(const std::string &url)
+{
+	return tuners.pickFrontend(serverOfUrl(url), urlParameter(url, "msys"),
+			atoi(urlParameter(url, "freq").c_str()));
+}
+
+void OctonetData::frontendFailed(const std::string &url, int frontend)
+{
+	tuners.frontendFailed(serverOfUrl(url), frontend, urlParameter(url, "msys"));
+}
+
+void OctonetData::streamOpened(const std::string &url, int frontend)
+{
+	tuners.acquired(serverOfUrl(url), frontend, atoi(urlParameter(url, "freq").c_str()));
+}
+
+void OctonetData::streamStatus(const std::string &url, int frontend, int level, int quality)
+{
+	tuners.sample(serverOfUrl(url), frontend, level, quality);
+}
+
+void OctonetData::streamClosed(const std::string &url, int frontend)
+{
+	tuners.released(serverOfUrl(url), frontend);
+}
+
+std::string OctonetData::getName(int id) const {
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+	const OctonetChannel *chan = cat->findChannel(id);
 
-	return channels[0].name;
+	return chan != NULL ? chan->name : "";
+}
+
+bool OctonetData::isRadio(int id) const {
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+	const OctonetChannel *chan = cat->findChannel(id);
+
+	return chan != NULL && chan->radio;
+}
+
+bool OctonetData::getNowNext(int id, std::string &now, std::string &next) const
+{
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+	const OctonetChannel *chan = cat->findChannel(id);
+	if (chan == NULL)
+		return false;
+
+	const OctonetEpg &epg = *chan->epg;
+	time_t t = time(NULL);
+	size_t current = epg.findCurrent(t);
+	if (current == epg.size() || epg.start[current] > t)
+		return false;
+
+	now = cat->epgStrings->get(epg.title[current]);
+	next = current + 1 < epg.size() ? cat->epgStrings->get(epg.title[current + 1]) : "";
+	return true;
 }
 
 int OctonetData::getGroupCount(void)
 {
-	return groups.size();
+	return getCatalogue()->groups.size();
 }
 
 PVR_ERROR OctonetData::getGroups(ADDON_HANDLE handle, bool bRadio)
 {
-	for (unsigned int i = 0; i < groups.size(); i++)
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+
+	for (unsigned int i = 0; i < cat->groups.size(); i++)
 	{
-		OctonetGroup &group = groups.at(i);
+		const OctonetGroup &group = cat->groups.at(i);
 		if (group.radio == bRadio)
 		{
 			PVR_CHANNEL_GROUP g;
@@ -338,19 +1029,20 @@ PVR_ERROR OctonetData::getGroups(ADDON_HANDLE handle, bool bRadio)
 
 PVR_ERROR OctonetData::getGroupMembers(ADDON_HANDLE handle, const PVR_CHANNEL_GROUP &group)
 {
-	OctonetGroup *g = findGroup(group.strGroupName);
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+	const OctonetGroup *g = cat->findGroup(group.strGroupName);
 	if (g == NULL)
 		return PVR_ERROR_UNKNOWN;
 
 	for (unsigned int i = 0; i < g->members.size(); i++)
 	{
-		OctonetChannel &channel = channels.at(g->members[i]);
+		const OctonetChannel &channel = cat->channels.at(g->members[i]);
 		PVR_CHANNEL_GROUP_MEMBER m;
 		memset(&m, 0, sizeof(PVR_CHANNEL_GROUP_MEMBER));
 
 		strncpy(m.strGroupName, group.strGroupName, strlen(group.strGroupName));
 		m.iChannelUniqueId = channel.id;
-		m.iChannelNumber = channel.id;
+		m.iChannelNumber = 1000 + g->members[i];
 
 		pvr->TransferChannelGroupMember(handle, &m);
 	}
@@ -358,13 +1050,28 @@ PVR_ERROR OctonetData::getGroupMembers(ADDON_HANDLE handle, const PVR_CHANNEL_GR
 	return PVR_ERROR_NO_ERROR;
 }
 
-OctonetGroup* OctonetData::findGroup(const std::string &name)
+void OctonetData::logDiagnostics(void)
 {
-	for (unsigned int i = 0; i < groups.size(); i++)
-	{
-		if (groups.at(i).name == name)
-			return &groups.at(i);
+	std::shared_ptr<const OctonetCatalogue> cat = getCatalogue();
+
+	size_t epgEvents = 0;
+	size_t epgBytes = 0;
+	for (std::vector<OctonetChannel>::const_iterator it = cat->channels.begin(); it != cat->channels.end(); ++it) {
+		epgEvents += it->epg->size();
+		epgBytes += it->epg->memoryUsage();
 	}
 
-	return NULL;
+	libKodi->Log(LOG_NOTICE, "diagnostics: %zu channels, %zu groups", cat->channels.size(), cat->groups.size());
+	libKodi->Log(LOG_NOTICE, "diagnostics: epg %zu events, %zu bytes event data", epgEvents, epgBytes);
+
+	P8PLATFORM::CLockObject lock(updateMutex);
+	OctonetStringPoolStats pool = epgStrings.getStats();
+	libKodi->Log(LOG_NOTICE, "diagnostics: epg strings %zu unique, %zu bytes (%zu dead), %zu bytes total",
+			pool.strings, pool.bytes, pool.deadBytes, pool.memoryUsage);
+	libKodi->Log(LOG_NOTICE, "diagnostics: epg strings %zu lookups, %zu hits, %zu compactions",
+			pool.lookups, pool.hits, pool.compactions);
+	libKodi->Log(LOG_NOTICE, "diagnostics: channel list %zu revalidations, %zu updates",
+			channelListRefreshes, channelListUpdates);
+	epgScheduler.logDiagnostics();
+	tuners.logDiagnostics();
 }
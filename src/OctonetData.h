@@ -22,31 +22,31 @@
  *
  */
 
+#include <atomic>
+#include <list>
+#include <memory>
 #include <vector>
 
 #include "p8-platform/threads/threads.h"
 #include "p8-platform/util/StdString.h"
 #include "client.h"
-
-struct OctonetEpgEntry
-{
-	int64_t channelId;
-	time_t start;
-	time_t end;
-	int id;
-	std::string title;
-	std::string subtitle;
-};
+#include "EpgScheduler.h"
+#include "HttpResource.h"
+#include "OctonetEpg.h"
+#include "OctonetStringPool.h"
+#include "TunerMonitor.h"
 
 struct OctonetChannel
 {
 	int64_t nativeId;
 	std::string name;
-	std::string url;
+	/* One stream URL per server carrying the channel */
+	std::vector<std::string> urls;
 	bool radio;
 	int id;
 
-	std::vector<OctonetEpgEntry> epg;
+	/* Shared between catalogues as long as it does not change */
+	std::shared_ptr<const OctonetEpg> epg;
 };
 
 struct OctonetGroup
@@ -56,10 +56,57 @@ struct OctonetGroup
 	std::vector<int> members;
 };
 
+/*
+ * Everything the addon knows about the server. A catalogue is never modified
+ * once published; refreshes build a new one and swap it in, so readers
+ * work on a consistent state without taking any lock.
+ */
+struct OctonetCatalogue
+{
+	std::vector<OctonetChannel> channels;
+	std::vector<OctonetGroup> groups;
+	std::shared_ptr<const OctonetStringArena> epgStrings;
+
+	const OctonetChannel* findChannel(int id) const;
+	const OctonetChannel* findChannelByNativeId(int64_t nativeId) const;
+	const OctonetGroup* findGroup(const std::string &name) const;
+};
+
+/* Differences between two catalogues, as far as Kodi is concerned */
+struct OctonetCatalogueDiff
+{
+	size_t channelsAdded;
+	size_t channelsRemoved;
+	size_t channelsChanged;
+	size_t groupsAdded;
+	size_t groupsRemoved;
+	size_t groupsChanged;
+
+	OctonetCatalogueDiff(const OctonetCatalogue &from, const OctonetCatalogue &to);
+
+	bool channels(void) const { return channelsAdded + channelsRemoved + channelsChanged > 0; }
+	bool groups(void) const { return groupsAdded + groupsRemoved + groupsChanged > 0; }
+};
+
+struct OctonetServer
+{
+	std::string address;
+	HttpResource channelList;
+	HttpResource epg;
+	/* Last content of each resource. Only kept with several servers,
+	 * where a change on one needs the content of all of them */
+	std::string channelListContent;
+	std::string epgContent;
+
+	explicit OctonetServer(const std::string &address);
+};
+
 class OctonetData : public P8PLATFORM::CThread
 {
 	public:
-		OctonetData(void);
+		/* epgDays is Kodi's EPG time frame, it applies from the first
+		 * EPG load on */
+		OctonetData(const std::string &addresses, int epgDays);
 		virtual ~OctonetData(void);
 
 		virtual int getChannelCount(void);
@@ -70,24 +117,83 @@ class OctonetData : public P8PLATFORM::CThread
 		virtual PVR_ERROR getGroupMembers(ADDON_HANDLE handle, const PVR_CHANNEL_GROUP &group);
 
 		virtual PVR_ERROR getEPG(ADDON_HANDLE handle, const PVR_CHANNEL &channel, time_t start, time_t end);
-		const std::string& getUrl(int id) const;
-		const std::string& getName(int id) const;
+		/* Stream URLs of a channel, one per server offering it */
+		std::vector<std::string> getUrls(int id) const;
+		/* The given URLs in the order they should be tried, servers known
+		 * to be out of tuners are left out */
+		std::vector<std::string> admitUrls(const std::vector<std::string> &urls);
+		/* Frontend a stream should be pinned to with fe=, 0 to let the
+		 * server choose */
+		int pickFrontend(const std::string &url);
+		void frontendFailed(const std::string &url, int frontend);
+		void streamOpened(const std::string &url, int frontend);
+		void streamStatus(const std::string &url, int frontend, int level, int quality);
+		void streamClosed(const std::string &url, int frontend);
+		std::string getName(int id) const;
+		bool isRadio(int id) const;
+		/* Titles of the events running now and next on a channel */
+		bool getNowNext(int id, std::string &now, std::string &next) const;
+
+		void logDiagnostics(void);
+
+		/* Number of days into the future Kodi shows, or
+		 * EPG_TIMEFRAME_UNLIMITED */
+		void setEpgTimeFrame(int days);
+
+		/* Switch to other servers, given as a list separated by ';'.
+		 * Channels and EPG are revalidated in the background and kept as
+		 * far as they match */
+		void setServerAddress(const std::string &addresses);
+		/* The configured addresses. Kodi keeps the pointer, so every
+		 * address handed out stays valid for the life of the object */
+		const char* getServerAddress(void) const;
 
 	protected:
-		virtual bool loadChannelList(void);
-		virtual bool loadEPG(void);
-		virtual OctonetGroup* findGroup(const std::string &name);
+		virtual bool loadChannelList(bool notify = false);
+		virtual bool loadEPG(bool notify = false);
+		void evictEPG(time_t now);
+		time_t getEpgWindowEnd(time_t now) const;
 
 		virtual void *Process(void);
 
-		OctonetChannel* findChannel(int64_t nativeId);
-		time_t parseDateTime(std::string date);
-		int64_t parseID(std::string id);
+		std::shared_ptr<const OctonetCatalogue> getCatalogue(void) const;
+		void publish(const std::shared_ptr<const OctonetCatalogue> &catalogue);
 
-	private:
-		std::string serverAddress;
-		std::vector<OctonetChannel> channels;
-		std::vector<OctonetGroup> groups;
+		HttpFetchResult fetchAll(HttpResource OctonetServer::*resource, std::string OctonetServer::*cache,
+				std::vector<std::string> &contents, size_t &failures);
 
-		time_t lastEpgLoad;
+		int64_t parseID(const std::string &id);
+
+	private:
+		std::shared_ptr<const OctonetCatalogue> catalogue;
+
+		mutable P8PLATFORM::CMutex addressMutex;
+		/* Every address set so far, the last one is current */
+		std::list<std::string> addressHistory;
+
+		/* Serializes refreshes, readers never take it. Everything below
+		 * is only touched with it held. */
+		P8PLATFORM::CMutex updateMutex;
+		OctonetStringPool epgStrings;
+
+		std::string serverAddresses;
+		std::vector<OctonetServer> servers;
+		/* Except for isDue and skipped, which are atomic and called by
+		 * EPG requests without the lock. loadEPG checks isDue again
+		 * with the lock held. */
+		EpgScheduler epgScheduler;
+		/* End of the window the current EPG was cut to, 0 if nothing
+		 * was cut off */
+		time_t epgCutOff;
+		time_t lastEviction;
+		time_t lastChannelListLoad;
+		size_t channelListRefreshes;
+		size_t channelListUpdates;
+
+		std::atomic<int> epgDays;
+
+		/* Has its own lock, streams are admitted without updateMutex */
+		TunerMonitor tuners;
+		/* Where admitUrls starts its round robin over the servers */
+		std::atomic<unsigned int> nextServer;
 };
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+
+#include "OctonetEpg.h"
+
+void OctonetEpg::clear(void)
+{
+	start.clear();
+	end.clear();
+	id.clear();
+	title.clear();
+	subtitle.clear();
+}
+
+void OctonetEpg::add(time_t start, time_t end, int id, const OctonetStringRef &title, const OctonetStringRef &subtitle)
+{
+	this->start.push_back(start);
+	this->end.push_back(end);
+	this->id.push_back(id);
+	this->title.push_back(title);
+	this->subtitle.push_back(subtitle);
+}
+
+void OctonetEpg::swap(OctonetEpg &other)
+{
+	start.swap(other.start);
+	end.swap(other.end);
+	id.swap(other.id);
+	title.swap(other.title);
+	subtitle.swap(other.subtitle);
+}
+
+void OctonetEpg::finalize(void)
+{
+	std::vector<size_t> order(size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+		return start[a] < start[b];
+	});
+
+	OctonetEpg sorted;
+	sorted.start.reserve(order.size());
+	sorted.end.reserve(order.size());
+	sorted.id.reserve(order.size());
+	sorted.title.reserve(order.size());
+	sorted.subtitle.reserve(order.size());
+
+	for (size_t i = 0; i < order.size(); i++) {
+		size_t j = order[i];
+
+		/* The server sometimes repeats an event, keep the last one */
+		if (!sorted.empty() && (sorted.start.back() == start[j] || sorted.id.back() == id[j])) {
+			sorted.start.back() = start[j];
+			sorted.end.back() = end[j];
+			sorted.id.back() = id[j];
+			sorted.title.back() = title[j];
+			sorted.subtitle.back() = subtitle[j];
+			continue;
+		}
+
+		sorted.add(start[j], end[j], id[j], title[j], subtitle[j]);
+	}
+
+	/* Overlapping events end where the next one starts, as in Kodi's own
+	 * EPG. This keeps the ends sorted for find() */
+	for (size_t i = 0; i < sorted.size(); i++) {
+		if (sorted.end[i] < sorted.start[i])
+			sorted.end[i] = sorted.start[i];
+		if (i + 1 < sorted.size() && sorted.end[i] > sorted.start[i + 1])
+			sorted.end[i] = sorted.start[i + 1];
+	}
+
+	swap(sorted);
+}
+
+size_t OctonetEpg::find(time_t t) const
+{
+	return std::upper_bound(end.begin(), end.end(), t) - end.begin();
+}
+
+size_t OctonetEpg::findCurrent(time_t t) const
+{
+	size_t pos = current.pos.load(std::memory_order_relaxed);
+
+	if (pos > size() || (pos > 0 && end[pos - 1] > t)) {
+		/* Clock went backwards or the cursor is stale */
+		pos = find(t);
+	} else {
+		while (pos < size() && end[pos] <= t)
+			pos++;
+	}
+
+	current.pos.store(pos, std::memory_order_relaxed);
+	return pos;
+}
+
+size_t OctonetEpg::memoryUsage(void) const
+{
+	return start.capacity() * sizeof(time_t)
+		+ end.capacity() * sizeof(time_t)
+		+ id.capacity() * sizeof(int)
+		+ title.capacity() * sizeof(OctonetStringRef)
+		+ subtitle.capacity() * sizeof(OctonetStringRef);
+}
+
+static inline int parseDigits2(const char *p)
+{
+	return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+static inline bool isDigit(char c)
+{
+	return (unsigned)(c - '0') < 10;
+}
+
+/* Days since 1970-01-01 of a proleptic gregorian date, see
+ * http://howardhinnant.github.io/date_algorithms.html#days_from_civil */
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned yoe = (unsigned)(y - era * 400);
+	const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+time_t OctonetEpg::parseDateTime(const std::string &date)
+{
+	const char *p = date.c_str();
+	int year, mon, mday, hour, min, sec;
+
+	if (date.length() > 8) {
+		if (date.length() >= 19 && p[4] == '-' && p[7] == '-' && p[10] == 'T' &&
+				p[13] == ':' && p[16] == ':' &&
+				isDigit(p[0]) && isDigit(p[1]) && isDigit(p[2]) && isDigit(p[3])) {
+			year = parseDigits2(p) * 100 + parseDigits2(p + 2);
+			mon = parseDigits2(p + 5);
+			mday = parseDigits2(p + 8);
+			hour = parseDigits2(p + 11);
+			min = parseDigits2(p + 14);
+			sec = parseDigits2(p + 17);
+		} else {
+			year = mon = mday = hour = min = sec = 0;
+			sscanf(p, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+					&year, &mon, &mday, &hour, &min, &sec);
+		}
+
+		return daysFromCivil(year, mon, mday) * 86400 + hour * 3600 + min * 60 + sec;
+	}
+
+	if (date.length() == 8 && p[2] == ':' && p[5] == ':') {
+		hour = parseDigits2(p);
+		min = parseDigits2(p + 3);
+		sec = parseDigits2(p + 6);
+	} else {
+		hour = min = sec = 0;
+		sscanf(p, "%02d:%02d:%02d", &hour, &min, &sec);
+	}
+
+	return hour * 3600 + min * 60 + sec;
+}
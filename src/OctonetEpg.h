@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <atomic>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "OctonetStringPool.h"
+
+/* Position cache that is not part of the value of the owning object */
+struct OctonetEpgCursor
+{
+	mutable std::atomic<size_t> pos;
+
+	OctonetEpgCursor(void) : pos(0) {}
+	OctonetEpgCursor(const OctonetEpgCursor &) : pos(0) {}
+	OctonetEpgCursor& operator=(const OctonetEpgCursor &) { return *this; }
+};
+
+/* EPG events of a single channel, stored as parallel arrays */
+struct OctonetEpg
+{
+	std::vector<time_t> start;
+	std::vector<time_t> end;
+	std::vector<int> id;
+	std::vector<OctonetStringRef> title;
+	std::vector<OctonetStringRef> subtitle;
+
+	/* Index of the event running now, follows the clock */
+	OctonetEpgCursor current;
+
+	size_t size(void) const { return id.size(); }
+	bool empty(void) const { return id.empty(); }
+	void clear(void);
+	void add(time_t start, time_t end, int id, const OctonetStringRef &title, const OctonetStringRef &subtitle);
+	void swap(OctonetEpg &other);
+	/* Sort by start time, drop duplicates, cut overlapping events and
+	 * trim the allocations. Afterwards both start and end are sorted */
+	void finalize(void);
+	/* Index of the first event which has not ended at time t, size() if
+	 * there is none. O(1) for the current time, which only moves forward */
+	size_t findCurrent(time_t t) const;
+	/* Index of the first event which has not ended at time t */
+	size_t find(time_t t) const;
+	size_t memoryUsage(void) const;
+
+	/* Parses "YYYY-MM-DDTHH:MM:SSZ" into a UTC timestamp and
+	 * "HH:MM:SS" into seconds */
+	static time_t parseDateTime(const std::string &date);
+};
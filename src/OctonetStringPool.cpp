@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "OctonetStringPool.h"
+#include "Hash.h"
+
+#define POOL_INITIAL_SLOTS 1024
+
+uint32_t OctonetStringArena::append(const char *str, size_t length)
+{
+	if (chunks.empty() || used + length + 1 > chunks.back().size) {
+		Chunk chunk;
+		chunk.size = length + 1 > CHUNK_SIZE ? length + 1 : CHUNK_SIZE;
+		chunk.data.reset(new char[chunk.size], std::default_delete<char[]>());
+		chunks.push_back(chunk);
+		used = 0;
+	}
+
+	char *dest = chunks.back().data.get() + used;
+	memcpy(dest, str, length);
+	dest[length] = '\0';
+
+	uint32_t offset = ((uint32_t)(chunks.size() - 1) << CHUNK_SHIFT) + used;
+	used += length + 1;
+	bytes += length + 1;
+
+	return offset;
+}
+
+size_t OctonetStringArena::memoryUsage(void) const
+{
+	size_t usage = chunks.capacity() * sizeof(Chunk);
+	for (std::vector<Chunk>::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+		usage += it->size;
+
+	return usage;
+}
+
+OctonetStringPool::OctonetStringPool(void)
+{
+	clear();
+}
+
+void OctonetStringPool::clear(void)
+{
+	arena = OctonetStringArena();
+	entries.clear();
+	slots.assign(POOL_INITIAL_SLOTS, 0);
+	oldOffsets.clear();
+	newOffsets.clear();
+	generation = 0;
+	lookups = 0;
+	hits = 0;
+	compactions = 0;
+}
+
+OctonetStringRef OctonetStringPool::intern(const std::string &str)
+{
+	uint32_t hash = (uint32_t)fnv1a64(str.data(), str.size());
+	size_t mask = slots.size() - 1;
+
+	lookups++;
+	for (size_t i = hash & mask; slots[i] != 0; i = (i + 1) & mask) {
+		Entry &entry = entries[slots[i] - 1];
+		OctonetStringRef ref = { entry.offset, entry.length };
+		if (entry.hash == hash && entry.length == str.size() &&
+				memcmp(arena.get(ref), str.data(), str.size()) == 0) {
+			entry.generation = generation;
+			hits++;
+			return ref;
+		}
+	}
+
+	const Entry &entry = entries[insert(str, hash)];
+	OctonetStringRef ref = { entry.offset, entry.length };
+	return ref;
+}
+
+uint32_t OctonetStringPool::insert(const std::string &str, uint32_t hash)
+{
+	/* Keep the table at most half full */
+	if ((entries.size() + 1) * 2 > slots.size())
+		rehash(slots.size() * 2);
+
+	Entry entry;
+	entry.offset = arena.append(str.data(), str.size());
+	entry.length = str.size();
+	entry.hash = hash;
+	entry.generation = generation;
+
+	entries.push_back(entry);
+
+	size_t mask = slots.size() - 1;
+	size_t i = hash & mask;
+	while (slots[i] != 0)
+		i = (i + 1) & mask;
+	slots[i] = entries.size();
+
+	return entries.size() - 1;
+}
+
+void OctonetStringPool::rehash(size_t slotCount)
+{
+	slots.assign(slotCount, 0);
+
+	size_t mask = slotCount - 1;
+	for (size_t e = 0; e < entries.size(); e++) {
+		size_t i = entries[e].hash & mask;
+		while (slots[i] != 0)
+			i = (i + 1) & mask;
+		slots[i] = e + 1;
+	}
+}
+
+void OctonetStringPool::beginUpdate(void)
+{
+	generation++;
+	oldOffsets.clear();
+	newOffsets.clear();
+}
+
+bool OctonetStringPool::needsCompaction(void) const
+{
+	size_t dead = getStats().deadBytes;
+
+	/* Only worth it once more than half of the arena is garbage */
+	return dead > 0 && dead * 2 > arena.getBytes();
+}
+
+void OctonetStringPool::compact(void)
+{
+	OctonetStringArena newArena;
+	std::vector<Entry> newEntries;
+
+	oldOffsets.clear();
+	newOffsets.clear();
+
+	/* Entries are in offset order, so the remap tables stay sorted */
+	for (std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (it->generation != generation)
+			continue;
+
+		OctonetStringRef ref = { it->offset, it->length };
+		Entry entry = *it;
+		entry.offset = newArena.append(arena.get(ref), it->length);
+		newEntries.push_back(entry);
+
+		oldOffsets.push_back(it->offset);
+		newOffsets.push_back(entry.offset);
+	}
+
+	/* Snapshots keep the old chunks alive as long as they need them */
+	arena = newArena;
+	entries.swap(newEntries);
+
+	size_t slotCount = POOL_INITIAL_SLOTS;
+	while (entries.size() * 2 > slotCount)
+		slotCount *= 2;
+	rehash(slotCount);
+
+	compactions++;
+}
+
+OctonetStringRef OctonetStringPool::remap(const OctonetStringRef &ref) const
+{
+	std::vector<uint32_t>::const_iterator it = std::lower_bound(oldOffsets.begin(), oldOffsets.end(), ref.offset);
+	if (it == oldOffsets.end() || *it != ref.offset)
+		return ref;
+
+	OctonetStringRef result = { newOffsets[it - oldOffsets.begin()], ref.length };
+	return result;
+}
+
+std::shared_ptr<const OctonetStringArena> OctonetStringPool::snapshot(void) const
+{
+	return std::make_shared<OctonetStringArena>(arena);
+}
+
+OctonetStringPoolStats OctonetStringPool::getStats(void) const
+{
+	OctonetStringPoolStats stats;
+
+	stats.lookups = lookups;
+	stats.hits = hits;
+	stats.strings = entries.size();
+	stats.bytes = arena.getBytes();
+	stats.deadBytes = 0;
+	for (std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (it->generation != generation)
+			stats.deadBytes += it->length + 1;
+	}
+	stats.memoryUsage = arena.memoryUsage()
+		+ entries.capacity() * sizeof(Entry)
+		+ slots.capacity() * sizeof(uint32_t)
+		+ (oldOffsets.capacity() + newOffsets.capacity()) * sizeof(uint32_t);
+	stats.compactions = compactions;
+
+	return stats;
+}
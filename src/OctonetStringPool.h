@@ -0,0 +1,145 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct OctonetStringRef
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct OctonetStringPoolStats
+{
+	size_t lookups;
+	size_t hits;
+	size_t strings;
+	size_t bytes;
+	size_t deadBytes;
+	size_t memoryUsage;
+	size_t compactions;
+};
+
+/*
+ * Append-only storage of the interned strings. Strings are kept in chunks
+ * which never move, so a copy of the arena only copies the chunk list and
+ * shares the strings with the original, which may go on appending.
+ */
+class OctonetStringArena
+{
+	public:
+		OctonetStringArena(void) : used(0), bytes(0) {}
+
+		const char* get(const OctonetStringRef &ref) const
+		{
+			return chunks[ref.offset >> CHUNK_SHIFT].data.get() + (ref.offset & (CHUNK_SIZE - 1));
+		}
+
+		size_t getBytes(void) const { return bytes; }
+		size_t memoryUsage(void) const;
+
+	private:
+		friend class OctonetStringPool;
+
+		/* A string longer than a chunk gets a chunk of its own */
+		static const unsigned CHUNK_SHIFT = 16;
+		static const size_t CHUNK_SIZE = 1 << CHUNK_SHIFT;
+
+		struct Chunk
+		{
+			std::shared_ptr<char> data;
+			size_t size;
+		};
+
+		/* Copies the string and a terminating NUL, returns its offset */
+		uint32_t append(const char *str, size_t length);
+
+		std::vector<Chunk> chunks;
+		/* Bytes used in the last chunk and in all of them */
+		size_t used;
+		size_t bytes;
+};
+
+/*
+ * Arena owned, interned storage for EPG strings. Every distinct string is
+ * stored once, NUL terminated, so a reference can be handed to Kodi without
+ * a copy.
+ *
+ * The pool survives EPG refreshes: an update interns the new strings on top
+ * of the existing ones, and strings which were not used by the last update
+ * are only dropped once they make up most of the arena. Published
+ * snapshots share the arena instead of copying it.
+ */
+class OctonetStringPool
+{
+	public:
+		OctonetStringPool(void);
+
+		OctonetStringRef intern(const std::string &str);
+		const char* get(const OctonetStringRef &ref) const { return arena.get(ref); }
+		/* The strings interned so far, for readers which must not see
+		 * the pool change */
+		std::shared_ptr<const OctonetStringArena> snapshot(void) const;
+
+		/* Start a new update, strings not interned until the next
+		 * compact() call are considered dead */
+		void beginUpdate(void);
+		bool needsCompaction(void) const;
+		/* Drop dead strings. All live references need to be passed
+		 * through remap() afterwards */
+		void compact(void);
+		OctonetStringRef remap(const OctonetStringRef &ref) const;
+
+		void clear(void);
+		OctonetStringPoolStats getStats(void) const;
+
+	private:
+		struct Entry
+		{
+			uint32_t offset;
+			uint32_t length;
+			uint32_t hash;
+			uint32_t generation;
+		};
+
+		uint32_t insert(const std::string &str, uint32_t hash);
+		void rehash(size_t slotCount);
+
+		OctonetStringArena arena;
+		std::vector<Entry> entries;
+		/* Open addressing hash table of entry index + 1, 0 marks a free slot */
+		std::vector<uint32_t> slots;
+
+		/* Offsets before and after the last compaction, for remap() */
+		std::vector<uint32_t> oldOffsets;
+		std::vector<uint32_t> newOffsets;
+
+		uint32_t generation;
+		size_t lookups;
+		size_t hits;
+		size_t compactions;
+};
@@ -0,0 +1,782 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef TARGET_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <json/json.h>
+
+#include "Recorder.h"
+#include "OctonetData.h"
+#include "SessionManager.h"
+#include "client.h"
+
+using namespace ADDON;
+
+/* Written at once, a multiple of the block size of any disk */
+#define RECORDING_BLOCK_SIZE (1024 * 1024)
+#define RECORDING_BLOCK_ALIGN 4096
+/* Keeps the writer responsive to a stop */
+#define RECORDING_READ_TIMEOUT 500
+#define RECORDER_INDEX "recordings.json"
+/* Seconds until a timer which found no tuner tries again */
+#define RECORDER_RETRY_INTERVAL 30
+
+#define TIMER_TYPE_MANUAL 1
+#define TIMER_TYPE_EPG 2
+
+RecordingWriter::RecordingWriter(SessionManager &sessions, StreamConsumer *consumer, const std::string &path)
+	: sessions(sessions), consumer(consumer), path(path),
+#ifdef TARGET_WINDOWS
+	file(NULL),
+#else
+	fd(-1), direct(false),
+#endif
+	block(NULL), fill(0), written(0), failed(false)
+{
+}
+
+RecordingWriter::~RecordingWriter(void)
+{
+	stop();
+	sessions.close(consumer);
+
+#ifdef TARGET_WINDOWS
+	delete[] block;
+#else
+	free(block);
+#endif
+}
+
+bool RecordingWriter::start(void)
+{
+#ifdef TARGET_WINDOWS
+	block = new uint8_t[RECORDING_BLOCK_SIZE];
+#else
+	void *memory;
+	if (posix_memalign(&memory, RECORDING_BLOCK_ALIGN, RECORDING_BLOCK_SIZE) != 0)
+		return false;
+	block = (uint8_t*)memory;
+#endif
+
+	if (!openFile())
+		return false;
+
+	/* Waits for the thread to run, stop() right away would miss it
+	 * otherwise */
+	return CreateThread(true);
+}
+
+void RecordingWriter::stop(void)
+{
+	/* Waits for the rest of the buffer to be written */
+	if (IsRunning())
+		StopThread(0);
+	closeFile();
+}
+
+void *RecordingWriter::Process(void)
+{
+	while (!IsStopped()) {
+		fill += consumer->read(block + fill, RECORDING_BLOCK_SIZE - fill, RECORDING_READ_TIMEOUT);
+		if (fill < RECORDING_BLOCK_SIZE)
+			continue;
+
+		if (!writeFile(block, fill)) {
+			failed = true;
+			return NULL;
+		}
+		fill = 0;
+	}
+
+	/* Whatever arrived up to the stop */
+	int length;
+	while ((length = consumer->read(block + fill, RECORDING_BLOCK_SIZE - fill, 1)) > 0) {
+		fill += length;
+		if (fill == RECORDING_BLOCK_SIZE) {
+			if (!writeFile(block, fill)) {
+				failed = true;
+				return NULL;
+			}
+			fill = 0;
+		}
+	}
+
+	if (fill > 0 && !writeFile(block, fill))
+		failed = true;
+	fill = 0;
+
+	return NULL;
+}
+
+#ifdef TARGET_WINDOWS
+bool RecordingWriter::openFile(void)
+{
+	file = libKodi->OpenFileForWrite(path.c_str(), true);
+	if (file == NULL) {
+		libKodi->Log(LOG_ERROR, "%s: cannot create %s", __func__, path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool RecordingWriter::writeFile(const uint8_t *data, size_t length)
+{
+	if (libKodi->WriteFile(file, data, length) != (ssize_t)length) {
+		libKodi->Log(LOG_ERROR, "%s: cannot write %s", __func__, path.c_str());
+		return false;
+	}
+
+	written += length;
+	return true;
+}
+
+void RecordingWriter::closeFile(void)
+{
+	if (file != NULL)
+		libKodi->CloseFile(file);
+	file = NULL;
+}
+#else
+bool RecordingWriter::openFile(void)
+{
+#ifdef O_DIRECT
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	direct = fd >= 0;
+#endif
+	/* Not every filesystem supports O_DIRECT, tmpfs for one */
+	if (fd < 0)
+		fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		libKodi->Log(LOG_ERROR, "%s: cannot create %s: %s", __func__, path.c_str(), strerror(errno));
+		return false;
+	}
+
+#ifdef F_NOCACHE
+	fcntl(fd, F_NOCACHE, 1);
+#endif
+
+	return true;
+}
+
+bool RecordingWriter::writeFile(const uint8_t *data, size_t length)
+{
+	while (length > 0) {
+#ifdef O_DIRECT
+		/* Only whole blocks can go around the cache, the tail of the
+		 * recording goes through it */
+		if (direct && length % RECORDING_BLOCK_ALIGN != 0) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+			direct = false;
+		}
+#endif
+
+		ssize_t count = write(fd, data, length);
+		if (count < 0 && errno == EINTR)
+			continue;
+#ifdef O_DIRECT
+		/* Some filesystems only refuse O_DIRECT on the first write */
+		if (count < 0 && errno == EINVAL && direct) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+			direct = false;
+			continue;
+		}
+#endif
+		if (count <= 0) {
+			libKodi->Log(LOG_ERROR, "%s: cannot write %s: %s", __func__, path.c_str(), strerror(errno));
+			return false;
+		}
+
+		data += count;
+		length -= count;
+		written += count;
+	}
+
+	return true;
+}
+
+void RecordingWriter::closeFile(void)
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+}
+#endif
+
+Recorder::Recorder(OctonetData &data, SessionManager &sessions, const std::string &directory)
+	: data(data), sessions(sessions), directory(directory), nextTimerId(1)
+{
+	libKodi->CreateDirectory(directory.c_str());
+	load();
+
+	CreateThread(false);
+}
+
+Recorder::~Recorder(void)
+{
+	StopThread();
+
+	P8PLATFORM::CLockObject lock(mutex);
+	time_t now = time(NULL);
+	for (std::vector<Timer>::iterator it = timers.begin(); it != timers.end(); ++it) {
+		/* Picked up again by the next start if it is still on */
+		if (it->state == PVR_TIMER_STATE_RECORDING) {
+			finishRecording(stopTimer(*it, now));
+			it->state = PVR_TIMER_STATE_ABORTED;
+		}
+	}
+	save();
+}
+
+void *Recorder::Process(void)
+{
+	while (!IsStopped()) {
+		time_t now = time(NULL);
+		std::vector<Timer> starts;
+		std::vector<Stop> stops;
+		bool changed;
+		{
+			P8PLATFORM::CLockObject lock(mutex);
+			changed = update(now, starts, stops);
+		}
+
+		/* Tuning and closing files take a while, Kodi's calls for the
+		 * timers and recordings must not wait for that */
+		for (std::vector<Stop>::const_iterator it = stops.begin(); it != stops.end(); ++it)
+			finishRecording(*it);
+
+		for (std::vector<Timer>::const_iterator it = starts.begin(); it != starts.end(); ++it) {
+			Recording recording;
+			RecordingWriter *writer = startRecording(*it, now, recording);
+			if (writer == NULL)
+				continue;
+
+			bool taken;
+			{
+				P8PLATFORM::CLockObject lock(mutex);
+				Timer *timer = findTimer(it->id);
+				/* Unless it was deleted or changed meanwhile */
+				taken = timer != NULL && timer->state == PVR_TIMER_STATE_SCHEDULED && timer->channelId == it->channelId;
+				if (taken) {
+					libKodi->Log(LOG_DEBUG, "%s: recording %s into %s", __func__, timer->title.c_str(), recording.id.c_str());
+					recordings.push_back(recording);
+					timer->state = PVR_TIMER_STATE_RECORDING;
+					timer->recordingId = recording.id;
+					timer->writer = writer;
+					changed = true;
+				}
+			}
+
+			if (!taken) {
+				writer->stop();
+				delete writer;
+				libKodi->DeleteFile(getPath(recording.id).c_str());
+			}
+		}
+
+		if (changed) {
+			{
+				P8PLATFORM::CLockObject lock(mutex);
+				save();
+			}
+			pvr->TriggerTimerUpdate();
+			pvr->TriggerRecordingUpdate();
+		}
+
+		Sleep(1000);
+	}
+
+	return NULL;
+}
+
+bool Recorder::update(time_t now, std::vector<Timer> &starts, std::vector<Stop> &stops)
+{
+	bool changed = false;
+
+	for (std::vector<Timer>::iterator it = timers.begin(); it != timers.end();) {
+		Timer &timer = *it;
+		time_t begin = timer.start - timer.marginStart * 60;
+		time_t end = timer.end + timer.marginEnd * 60;
+
+		if (timer.state == PVR_TIMER_STATE_RECORDING && (now >= end || timer.writer->hasFailed())) {
+			stops.push_back(stopTimer(timer, now));
+			/* Done, what is left is the recording */
+			it = timers.erase(it);
+			changed = true;
+			continue;
+		}
+
+		if (timer.state == PVR_TIMER_STATE_SCHEDULED && now >= end) {
+			libKodi->Log(LOG_ERROR, "%s: missed %s", __func__, timer.title.c_str());
+			timer.state = PVR_TIMER_STATE_ERROR;
+			changed = true;
+		} else if (timer.state == PVR_TIMER_STATE_SCHEDULED && now >= begin && now >= timer.nextAttempt) {
+			/* Once it runs the state tells, until then this keeps it
+			 * from being started twice */
+			timer.nextAttempt = now + RECORDER_RETRY_INTERVAL;
+			starts.push_back(timer);
+		}
+
+		++it;
+	}
+
+	return changed;
+}
+
+RecordingWriter *Recorder::startRecording(const Timer &timer, time_t now, Recording &recording)
+{
+	StreamConsumer *consumer = sessions.open(timer.channelId, true);
+	if (consumer == NULL) {
+		libKodi->Log(LOG_ERROR, "%s: no tuner for %s", __func__, timer.title.c_str());
+		return NULL;
+	}
+
+	std::stringstream id;
+	id << now << "-" << timer.id;
+	recording.id = id.str();
+	recording.title = timer.title;
+	recording.plot = timer.summary;
+	recording.channelName = data.getName(timer.channelId);
+	recording.channelId = timer.channelId;
+	recording.radio = data.isRadio(timer.channelId);
+	recording.start = now;
+	recording.duration = 0;
+	recording.epgUid = timer.epgUid;
+	recording.active = true;
+
+	/* Closes the consumer if it fails */
+	RecordingWriter *writer = new RecordingWriter(sessions, consumer, getPath(recording.id));
+	if (!writer->start()) {
+		delete writer;
+		return NULL;
+	}
+
+	return writer;
+}
+
+Recorder::Stop Recorder::stopTimer(Timer &timer, time_t now)
+{
+	Stop stop = { timer.writer, timer.recordingId, now };
+
+	timer.writer = NULL;
+	timer.state = PVR_TIMER_STATE_COMPLETED;
+	timer.recordingId.clear();
+
+	return stop;
+}
+
+void Recorder::finishRecording(const Stop &stop)
+{
+	stop.writer->stop();
+	if (stop.writer->hasFailed())
+		libKodi->Log(LOG_ERROR, "%s: recording %s failed", __func__, stop.recordingId.c_str());
+	libKodi->Log(LOG_DEBUG, "%s: recorded %lld bytes into %s", __func__,
+			(long long)stop.writer->getWritten(), stop.recordingId.c_str());
+	delete stop.writer;
+
+	/* Playback treats it as growing until now */
+	P8PLATFORM::CLockObject lock(mutex);
+	Recording *recording = findRecording(stop.recordingId);
+	if (recording != NULL) {
+		recording->active = false;
+		recording->duration = stop.time - recording->start;
+	}
+}
+
+Recorder::Timer *Recorder::findTimer(unsigned int id)
+{
+	for (std::vector<Timer>::iterator it = timers.begin(); it != timers.end(); ++it) {
+		if (it->id == id)
+			return &*it;
+	}
+
+	return NULL;
+}
+
+Recorder::Recording *Recorder::findRecording(const std::string &id)
+{
+	for (std::vector<Recording>::iterator it = recordings.begin(); it != recordings.end(); ++it) {
+		if (it->id == id)
+			return &*it;
+	}
+
+	return NULL;
+}
+
+std::string Recorder::getPath(const std::string &id) const
+{
+	return directory + "/" + id + ".ts";
+}
+
+PVR_ERROR Recorder::getTimerTypes(PVR_TIMER_TYPE types[], int *size)
+{
+	/* Kodi brings the descriptions */
+	memset(types, 0, sizeof(PVR_TIMER_TYPE) * 2);
+
+	types[0].iId = TIMER_TYPE_MANUAL;
+	types[0].iAttributes = PVR_TIMER_TYPE_IS_MANUAL | PVR_TIMER_TYPE_SUPPORTS_CHANNELS |
+		PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME |
+		PVR_TIMER_TYPE_SUPPORTS_START_END_MARGIN;
+
+	types[1].iId = TIMER_TYPE_EPG;
+	types[1].iAttributes = PVR_TIMER_TYPE_SUPPORTS_CHANNELS | PVR_TIMER_TYPE_SUPPORTS_START_TIME |
+		PVR_TIMER_TYPE_SUPPORTS_END_TIME | PVR_TIMER_TYPE_SUPPORTS_START_END_MARGIN |
+		PVR_TIMER_TYPE_REQUIRES_EPG_TAG_ON_CREATE;
+
+	*size = 2;
+	return PVR_ERROR_NO_ERROR;
+}
+
+int Recorder::getTimerCount(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	return timers.size();
+}
+
+PVR_ERROR Recorder::getTimers(ADDON_HANDLE handle)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	for (std::vector<Timer>::const_iterator it = timers.begin(); it != timers.end(); ++it) {
+		PVR_TIMER timer;
+		memset(&timer, 0, sizeof(PVR_TIMER));
+
+		timer.iClientIndex = it->id;
+		timer.iClientChannelUid = it->channelId;
+		timer.startTime = it->start;
+		timer.endTime = it->end;
+		timer.iMarginStart = it->marginStart;
+		timer.iMarginEnd = it->marginEnd;
+		timer.state = it->state;
+		timer.iTimerType = it->epgUid != PVR_TIMER_NO_EPG_UID ? TIMER_TYPE_EPG : TIMER_TYPE_MANUAL;
+		timer.iEpgUid = it->epgUid;
+		strncpy(timer.strTitle, it->title.c_str(), PVR_ADDON_NAME_STRING_LENGTH - 1);
+		strncpy(timer.strSummary, it->summary.c_str(), PVR_ADDON_DESC_STRING_LENGTH - 1);
+
+		pvr->TransferTimerEntry(handle, &timer);
+	}
+
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR Recorder::addTimer(const PVR_TIMER &timer)
+{
+	std::string name = data.getName(timer.iClientChannelUid);
+	if (name.empty())
+		return PVR_ERROR_INVALID_PARAMETERS;
+
+	Timer t;
+	/* An instant recording has no start time */
+	t.start = timer.startTime > 0 ? timer.startTime : time(NULL);
+	t.end = timer.endTime;
+	if (t.end <= t.start)
+		return PVR_ERROR_INVALID_PARAMETERS;
+
+	t.channelId = timer.iClientChannelUid;
+	t.marginStart = timer.iMarginStart;
+	t.marginEnd = timer.iMarginEnd;
+	t.title = timer.strTitle[0] != '\0' ? timer.strTitle : name;
+	t.summary = timer.strSummary;
+	t.epgUid = timer.iEpgUid;
+	t.state = PVR_TIMER_STATE_SCHEDULED;
+	t.nextAttempt = 0;
+	t.writer = NULL;
+
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		t.id = nextTimerId++;
+		timers.push_back(t);
+		save();
+	}
+
+	pvr->TriggerTimerUpdate();
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR Recorder::updateTimer(const PVR_TIMER &timer)
+{
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+
+		Timer *t = findTimer(timer.iClientIndex);
+		if (t == NULL)
+			return PVR_ERROR_INVALID_PARAMETERS;
+		if (timer.endTime <= timer.startTime)
+			return PVR_ERROR_INVALID_PARAMETERS;
+
+		/* A running recording can only be made longer or shorter */
+		if (t->state != PVR_TIMER_STATE_RECORDING) {
+			t->channelId = timer.iClientChannelUid;
+			t->start = timer.startTime;
+			t->marginStart = timer.iMarginStart;
+			t->state = PVR_TIMER_STATE_SCHEDULED;
+			t->nextAttempt = 0;
+		}
+		t->end = timer.endTime;
+		t->marginEnd = timer.iMarginEnd;
+		t->title = timer.strTitle;
+		t->summary = timer.strSummary;
+		save();
+	}
+
+	pvr->TriggerTimerUpdate();
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR Recorder::deleteTimer(const PVR_TIMER &timer, bool force)
+{
+	Stop stop = { NULL, std::string(), 0 };
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+
+		Timer *t = findTimer(timer.iClientIndex);
+		if (t == NULL)
+			return PVR_ERROR_INVALID_PARAMETERS;
+
+		if (t->state == PVR_TIMER_STATE_RECORDING) {
+			if (!force)
+				return PVR_ERROR_RECORDING_RUNNING;
+			stop = stopTimer(*t, time(NULL));
+		}
+
+		timers.erase(timers.begin() + (t - &timers[0]));
+		save();
+	}
+
+	/* The rest of the recording is written without the mutex held */
+	if (stop.writer != NULL) {
+		finishRecording(stop);
+		P8PLATFORM::CLockObject lock(mutex);
+		save();
+	}
+
+	pvr->TriggerTimerUpdate();
+	pvr->TriggerRecordingUpdate();
+	return PVR_ERROR_NO_ERROR;
+}
+
+int Recorder::getRecordingCount(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	return recordings.size();
+}
+
+PVR_ERROR Recorder::getRecordings(ADDON_HANDLE handle)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	time_t now = time(NULL);
+	for (std::vector<Recording>::const_iterator it = recordings.begin(); it != recordings.end(); ++it) {
+		PVR_RECORDING recording;
+		memset(&recording, 0, sizeof(PVR_RECORDING));
+
+		strncpy(recording.strRecordingId, it->id.c_str(), PVR_ADDON_NAME_STRING_LENGTH - 1);
+		strncpy(recording.strTitle, it->title.c_str(), PVR_ADDON_NAME_STRING_LENGTH - 1);
+		strncpy(recording.strPlot, it->plot.c_str(), PVR_ADDON_DESC_STRING_LENGTH - 1);
+		strncpy(recording.strChannelName, it->channelName.c_str(), PVR_ADDON_NAME_STRING_LENGTH - 1);
+		recording.recordingTime = it->start;
+		recording.iDuration = it->active ? now - it->start : it->duration;
+		recording.iSeriesNumber = PVR_RECORDING_INVALID_SERIES_EPISODE;
+		recording.iEpisodeNumber = PVR_RECORDING_INVALID_SERIES_EPISODE;
+		recording.iEpgEventId = it->epgUid;
+		recording.iChannelUid = it->channelId;
+		recording.channelType = it->radio ? PVR_RECORDING_CHANNEL_TYPE_RADIO : PVR_RECORDING_CHANNEL_TYPE_TV;
+
+		pvr->TransferRecordingEntry(handle, &recording);
+	}
+
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR Recorder::deleteRecording(const PVR_RECORDING &recording)
+{
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+
+		Recording *r = findRecording(recording.strRecordingId);
+		if (r == NULL)
+			return PVR_ERROR_INVALID_PARAMETERS;
+		if (r->active)
+			return PVR_ERROR_RECORDING_RUNNING;
+
+		libKodi->DeleteFile(getPath(r->id).c_str());
+		recordings.erase(recordings.begin() + (r - &recordings[0]));
+		save();
+	}
+
+	pvr->TriggerRecordingUpdate();
+	return PVR_ERROR_NO_ERROR;
+}
+
+bool Recorder::getRecordingPath(const std::string &id, std::string &path)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	if (findRecording(id) == NULL)
+		return false;
+
+	path = getPath(id);
+	return true;
+}
+
+bool Recorder::isRecording(const std::string &id)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	Recording *recording = findRecording(id);
+	return recording != NULL && recording->active;
+}
+
+void Recorder::load(void)
+{
+	std::ifstream in((directory + "/" RECORDER_INDEX).c_str());
+	if (!in)
+		return;
+
+	std::stringstream content;
+	content << in.rdbuf();
+
+	Json::Value root;
+	Json::Reader reader;
+	if (!reader.parse(content.str(), root, false)) {
+		libKodi->Log(LOG_ERROR, "%s: invalid %s", __func__, RECORDER_INDEX);
+		return;
+	}
+
+	nextTimerId = root["nextTimerId"].asUInt();
+	if (nextTimerId == 0)
+		nextTimerId = 1;
+
+	time_t now = time(NULL);
+	const Json::Value timerList = root["timers"];
+	for (unsigned int i = 0; i < timerList.size(); i++) {
+		const Json::Value &t = timerList[i];
+		Timer timer;
+		timer.id = t["id"].asUInt();
+		timer.channelId = t["channel"].asInt();
+		timer.start = t["start"].asInt64();
+		timer.end = t["end"].asInt64();
+		timer.marginStart = t["marginStart"].asUInt();
+		timer.marginEnd = t["marginEnd"].asUInt();
+		timer.title = t["title"].asString();
+		timer.summary = t["summary"].asString();
+		timer.epgUid = t["epgUid"].asUInt();
+		timer.state = (PVR_TIMER_STATE)t["state"].asInt();
+		timer.nextAttempt = 0;
+		timer.writer = NULL;
+
+		/* One that was running when the addon stopped records the
+		 * rest into a new file, if there is a rest */
+		if (timer.state == PVR_TIMER_STATE_ABORTED && now >= timer.end + timer.marginEnd * 60)
+			continue;
+		if (timer.state != PVR_TIMER_STATE_ERROR)
+			timer.state = PVR_TIMER_STATE_SCHEDULED;
+		timers.push_back(timer);
+	}
+
+	const Json::Value recordingList = root["recordings"];
+	for (unsigned int i = 0; i < recordingList.size(); i++) {
+		const Json::Value &r = recordingList[i];
+		Recording recording;
+		recording.id = r["id"].asString();
+		recording.title = r["title"].asString();
+		recording.plot = r["plot"].asString();
+		recording.channelName = r["channelName"].asString();
+		recording.channelId = r["channel"].asInt();
+		recording.radio = r["radio"].asBool();
+		recording.start = r["start"].asInt64();
+		recording.duration = r["duration"].asInt();
+		recording.epgUid = r["epgUid"].asUInt();
+		recording.active = false;
+
+		if (libKodi->FileExists(getPath(recording.id).c_str(), false))
+			recordings.push_back(recording);
+	}
+
+	libKodi->Log(LOG_DEBUG, "%s: %zu timers, %zu recordings", __func__, timers.size(), recordings.size());
+}
+
+void Recorder::save(void)
+{
+	Json::Value root;
+	root["nextTimerId"] = nextTimerId;
+
+	Json::Value timerList(Json::arrayValue);
+	for (std::vector<Timer>::const_iterator it = timers.begin(); it != timers.end(); ++it) {
+		Json::Value t;
+		t["id"] = it->id;
+		t["channel"] = it->channelId;
+		t["start"] = (Json::Int64)it->start;
+		t["end"] = (Json::Int64)it->end;
+		t["marginStart"] = it->marginStart;
+		t["marginEnd"] = it->marginEnd;
+		t["title"] = it->title;
+		t["summary"] = it->summary;
+		t["epgUid"] = it->epgUid;
+		t["state"] = it->state;
+		timerList.append(t);
+	}
+	root["timers"] = timerList;
+
+	Json::Value recordingList(Json::arrayValue);
+	for (std::vector<Recording>::const_iterator it = recordings.begin(); it != recordings.end(); ++it) {
+		Json::Value r;
+		r["id"] = it->id;
+		r["title"] = it->title;
+		r["plot"] = it->plot;
+		r["channelName"] = it->channelName;
+		r["channel"] = it->channelId;
+		r["radio"] = it->radio;
+		r["start"] = (Json::Int64)it->start;
+		r["duration"] = it->duration;
+		r["epgUid"] = it->epgUid;
+		recordingList.append(r);
+	}
+	root["recordings"] = recordingList;
+
+	/* Replaced in one go, a crash leaves either index intact */
+	std::string path = directory + "/" RECORDER_INDEX;
+	std::string temporary = path + ".new";
+	{
+		std::ofstream out(temporary.c_str(), std::ios::trunc);
+		Json::StreamWriterBuilder builder;
+		out << Json::writeString(builder, root);
+		if (!out) {
+			libKodi->Log(LOG_ERROR, "%s: cannot write %s", __func__, temporary.c_str());
+			return;
+		}
+	}
+#ifdef TARGET_WINDOWS
+	std::remove(path.c_str());
+#endif
+	std::rename(temporary.c_str(), path.c_str());
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <p8-platform/threads/mutex.h>
+#include <p8-platform/threads/threads.h>
+#include <xbmc_pvr_types.h>
+
+class OctonetData;
+class SessionManager;
+class StreamConsumer;
+
+/*
+ * Copies one stream into a file on its own thread. The receiver never
+ * waits for the disk: it keeps filling the consumer's buffer, and a disk
+ * that stalls for longer than the buffer lasts only costs the oldest
+ * data.
+ *
+ * Data goes to the file in large, aligned blocks, bypassing the page cache
+ * with O_DIRECT where the filesystem allows it.
+ */
+class RecordingWriter : public P8PLATFORM::CThread
+{
+	public:
+		/* Takes over the consumer, which is closed with the writer */
+		RecordingWriter(SessionManager &sessions, StreamConsumer *consumer, const std::string &path);
+		virtual ~RecordingWriter(void);
+
+		/* Creates the file and starts the thread */
+		bool start(void);
+		/* Writes out what is still buffered and closes the file */
+		void stop(void);
+
+		int64_t getWritten(void) const { return written; }
+		bool hasFailed(void) const { return failed; }
+
+	protected:
+		virtual void *Process(void);
+
+	private:
+		bool openFile(void);
+		bool writeFile(const uint8_t *data, size_t length);
+		void closeFile(void);
+
+		SessionManager &sessions;
+		StreamConsumer *consumer;
+		std::string path;
+
+#ifdef TARGET_WINDOWS
+		void *file;
+#else
+		int fd;
+		bool direct;
+#endif
+		/* Aligned for O_DIRECT */
+		uint8_t *block;
+		size_t fill;
+		std::atomic<int64_t> written;
+		std::atomic<bool> failed;
+};
+
+/*
+ * Local recordings. Timers are kept by the addon and started by its own
+ * thread, every running one has its own consumer and writer. Timers and
+ * recordings are kept in an index next to the recorded files.
+ */
+class Recorder : public P8PLATFORM::CThread
+{
+	public:
+		Recorder(OctonetData &data, SessionManager &sessions, const std::string &directory);
+		virtual ~Recorder(void);
+
+		PVR_ERROR getTimerTypes(PVR_TIMER_TYPE types[], int *size);
+		int getTimerCount(void);
+		PVR_ERROR getTimers(ADDON_HANDLE handle);
+		PVR_ERROR addTimer(const PVR_TIMER &timer);
+		PVR_ERROR updateTimer(const PVR_TIMER &timer);
+		/* A running timer is only stopped with force, its recording
+		 * is kept */
+		PVR_ERROR deleteTimer(const PVR_TIMER &timer, bool force);
+
+		int getRecordingCount(void);
+		PVR_ERROR getRecordings(ADDON_HANDLE handle);
+		PVR_ERROR deleteRecording(const PVR_RECORDING &recording);
+		/* Path of a recorded file, false if there is no such recording */
+		bool getRecordingPath(const std::string &id, std::string &path);
+		/* Still being written */
+		bool isRecording(const std::string &id);
+
+	protected:
+		virtual void *Process(void);
+
+	private:
+		struct Timer
+		{
+			unsigned int id;
+			int channelId;
+			/* Of the programme, the margins are in minutes */
+			time_t start;
+			time_t end;
+			unsigned int marginStart;
+			unsigned int marginEnd;
+			std::string title;
+			std::string summary;
+			unsigned int epgUid;
+			PVR_TIMER_STATE state;
+			/* When to try again if no tuner was free */
+			time_t nextAttempt;
+			/* While it runs */
+			std::string recordingId;
+			RecordingWriter *writer;
+		};
+
+		struct Recording
+		{
+			std::string id;
+			std::string title;
+			std::string plot;
+			std::string channelName;
+			int channelId;
+			bool radio;
+			time_t start;
+			int duration;
+			unsigned int epgUid;
+			bool active;
+		};
+
+		/* A writer taken off its timer, to be stopped without the
+		 * mutex held */
+		struct Stop
+		{
+			RecordingWriter *writer;
+			std::string recordingId;
+			time_t time;
+		};
+
+		/* Collects the timers due to start or stop and marks missed
+		 * ones, true if anything changed */
+		bool update(time_t now, std::vector<Timer> &starts, std::vector<Stop> &stops);
+		/* Opens the stream and the file of a timer, NULL if either
+		 * fails. Runs without the mutex held */
+		RecordingWriter *startRecording(const Timer &timer, time_t now, Recording &recording);
+		Stop stopTimer(Timer &timer, time_t now);
+		/* Waits for the rest of the recording to be written, takes the
+		 * mutex only at the end */
+		void finishRecording(const Stop &stop);
+		Timer *findTimer(unsigned int id);
+		Recording *findRecording(const std::string &id);
+		std::string getPath(const std::string &id) const;
+
+		void load(void);
+		void save(void);
+
+		OctonetData &data;
+		SessionManager &sessions;
+		std::string directory;
+
+		P8PLATFORM::CMutex mutex;
+		std::vector<Timer> timers;
+		std::vector<Recording> recordings;
+		unsigned int nextTimerId;
+};
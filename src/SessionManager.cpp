@@ -0,0 +1,1048 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+#include <p8-platform/util/timeutils.h>
+
+#include "SessionManager.h"
+#include "OctonetData.h"
+#include "rtsp_client.hpp"
+#include "client.h"
+
+using namespace ADDON;
+
+/* Per consumer buffer, about a second of a busy HD transponder */
+#define CONSUMER_BUFFER_SIZE (4 * 1024 * 1024)
+/* Lets a recording ride out some seconds of a stalled disk */
+#define RECORDING_BUFFER_SIZE (32 * 1024 * 1024)
+/* Largest buffer kept around for the next stream after playback stopped */
+#define SPARE_BUFFER_MAX (128 * 1024 * 1024)
+#define RTP_PACKET_SIZE 2048
+#define RTP_HEADER_SIZE 12
+/* Upper bound of the TS data handed to the consumers at once */
+#define SESSION_BATCH_SIZE (64 * 1024)
+/* How long the receiver waits for a packet before doing housekeeping */
+#define SESSION_READ_TIMEOUT 100
+/* How often the control thread checks whether a keepalive is due */
+#define SESSION_CONTROL_INTERVAL 1000
+/* Seconds before a refused PID change is sent again, doubled up to the
+ * maximum while the server keeps refusing */
+#define PIDS_RETRY_MIN 2
+#define PIDS_RETRY_MAX 60
+/* Seconds between two samples of the signal for the frontend statistics */
+#define TUNER_SAMPLE_INTERVAL 5
+/* PAT and PMT are repeated at least every half second */
+#define STREAM_PROPERTIES_TIMEOUT 2000
+/* Longest GOP waited for before a stream is passed on as it is */
+#define FAST_START_TIMEOUT 3000
+/* Upper bound of the PAT or PMT packets kept for a fast start */
+#define FAST_START_PSI_SIZE (16 * TS_PACKET_SIZE)
+
+#ifndef DVD_TIME_BASE
+#define DVD_TIME_BASE 1000000
+#endif
+
+static std::string urlParameter(const std::string &url, const std::string &name, size_t *begin = NULL, size_t *end = NULL)
+{
+	size_t pos = url.find('?');
+	while (pos != std::string::npos) {
+		size_t param = ++pos;
+		if (url.compare(pos, name.size() + 1, name + "=") == 0) {
+			pos += name.size() + 1;
+			size_t last = std::min(url.find('&', pos), url.size());
+			if (begin != NULL)
+				*begin = param;
+			if (end != NULL)
+				*end = last;
+			return url.substr(pos, last - pos);
+		}
+		pos = url.find('&', pos);
+	}
+
+	return std::string();
+}
+
+/* Streams which only differ in their PIDs share a frontend */
+static std::string tuningKey(const std::string &url)
+{
+	size_t begin, end;
+	std::string pids = urlParameter(url, "pids", &begin, &end);
+	if (pids.empty() || pids == "all" || pids == "none")
+		return std::string();
+
+	return url.substr(0, begin) + url.substr(std::min(end + 1, url.size()));
+}
+
+static std::vector<int> parsePids(const std::string &url)
+{
+	std::vector<int> result;
+	std::string pids = urlParameter(url, "pids");
+	if (pids == "all" || pids == "none")
+		return result;
+
+	std::stringstream ss(pids);
+	std::string pid;
+	while (std::getline(ss, pid, ',')) {
+		int value = atoi(pid.c_str());
+		if (!pid.empty() && value >= 0 && value < TS_PID_COUNT)
+			result.push_back(value);
+	}
+
+	return result;
+}
+
+/* Whether a decoder can start with the PES this packet starts */
+static bool isRandomAccess(const uint8_t *packet, TsStreamKind kind, int type)
+{
+	if (!(packet[1] & 0x40) || !(packet[3] & 0x10))
+		return false;
+
+	size_t offset = 4;
+	if (packet[3] & 0x20) {
+		if (packet[4] > 0 && (packet[5] & 0x40))
+			return true;
+		offset += 1 + packet[4];
+	}
+
+	/* Every audio frame decodes on its own */
+	if (kind == TS_STREAM_AUDIO)
+		return true;
+
+	/* Not every mux sets the random access indicator, so look for a
+	 * sequence header or parameter set in the payload as well */
+	if (offset + 9 > TS_PACKET_SIZE)
+		return false;
+	if (packet[offset] != 0 || packet[offset + 1] != 0 || packet[offset + 2] != 1)
+		return false;
+	offset += 9 + packet[offset + 8];
+
+	for (size_t i = offset; i + 3 < TS_PACKET_SIZE; i++) {
+		if (packet[i] != 0 || packet[i + 1] != 0 || packet[i + 2] != 1)
+			continue;
+
+		int code = packet[i + 3];
+		switch (type) {
+		case 0x01:
+		case 0x02:
+			if (code == 0xb3)
+				return true;
+			break;
+		case 0x1b:
+			if ((code & 0x1f) == 5 || (code & 0x1f) == 7)
+				return true;
+			break;
+		case 0x24:
+			if (((code >> 1) & 0x3f) == 32 || (((code >> 1) & 0x3f) >= 16 && ((code >> 1) & 0x3f) <= 21))
+				return true;
+			break;
+		}
+	}
+
+	return false;
+}
+
+static std::string joinPids(const std::vector<int> &pids)
+{
+	std::stringstream ss;
+	for (size_t i = 0; i < pids.size(); i++)
+		ss << (i > 0 ? "," : "") << pids[i];
+
+	return ss.str();
+}
+
+StreamConsumer::StreamConsumer(const std::string &name, const std::string &url, bool fastStart, StreamBuffer *buffer)
+	: name(name), url(url), urlPids(parsePids(url)), pids(urlPids), pmtPid(-1), pidsChanged(false),
+	pidsRetry(0), pidsBackoff(PIDS_RETRY_MIN),
+	starting(fastStart && !urlPids.empty()), startDeadline(0), startPid(-1), startKind(TS_STREAM_OTHER), startType(0),
+	programKnown(false), readable(false), buffer(buffer), position(0), readEnd(-1), readJump(-1), timeshifting(false), dropped(0), session(NULL)
+{
+	filter.set(pids);
+	programMap.version = -1;
+	programMap.pcrPid = TS_PID_NULL;
+}
+
+void StreamConsumer::parsePsi(const uint8_t *packet)
+{
+	int pid = ((packet[1] & 0x1f) << 8) | packet[2];
+
+	if (pid == TS_PID_PAT) {
+		std::map<int, int> programs;
+		if (!patAssembler.push(packet) || !tsParsePat(patAssembler.getSection(), programs))
+			return;
+
+		/* Our service is the one whose PMT the URL asks for */
+		for (std::map<int, int>::const_iterator it = programs.begin(); it != programs.end(); ++it) {
+			if (it->second == pmtPid)
+				return;
+			if (std::find(urlPids.begin(), urlPids.end(), it->second) != urlPids.end()) {
+				P8PLATFORM::CLockObject lock(mutex);
+				pmtPid = it->second;
+				programMap.program = it->first;
+				programMap.version = -1;
+				programKnown = false;
+				pmtAssembler.reset();
+				return;
+			}
+		}
+	} else if (pid == pmtPid) {
+		TsProgramMap pmt;
+		if (!pmtAssembler.push(packet) || !tsParsePmt(pmtAssembler.getSection(), pmt))
+			return;
+		if (pmt.program != programMap.program || pmt.version == programMap.version)
+			return;
+
+		{
+			P8PLATFORM::CLockObject lock(mutex);
+			programMap = pmt;
+			programKnown = true;
+			programCondition.Broadcast();
+		}
+
+		/* Tables of the transport stream as far as the URL asked for
+		 * them, the PSI of the service and everything decodable */
+		std::set<int> wanted;
+		for (std::vector<int>::const_iterator it = urlPids.begin(); it != urlPids.end(); ++it) {
+			if (*it < TS_PID_SI_END)
+				wanted.insert(*it);
+		}
+		wanted.insert(TS_PID_PAT);
+		wanted.insert(pmtPid);
+		if (pmt.pcrPid != TS_PID_NULL)
+			wanted.insert(pmt.pcrPid);
+		for (std::vector<TsElementaryStream>::const_iterator it = pmt.streams.begin(); it != pmt.streams.end(); ++it) {
+			if (it->codec != NULL)
+				wanted.insert(it->pid);
+		}
+
+		wantedPids.assign(wanted.begin(), wanted.end());
+		pidsChanged = wantedPids != pids;
+		/* A new PMT is worth asking for right away */
+		pidsRetry = 0;
+
+		/* Start with the video if there is one, radio with the audio */
+		startPid = -1;
+		for (std::vector<TsElementaryStream>::const_iterator it = pmt.streams.begin(); it != pmt.streams.end(); ++it) {
+			if (it->codec == NULL || (it->kind != TS_STREAM_VIDEO && it->kind != TS_STREAM_AUDIO))
+				continue;
+			if (startPid < 0 || (it->kind == TS_STREAM_VIDEO && startKind != TS_STREAM_VIDEO)) {
+				startPid = it->pid;
+				startKind = it->kind;
+				startType = it->type;
+			}
+		}
+	}
+}
+
+void StreamConsumer::push(const unsigned char *packets, size_t count)
+{
+	if (accepted.size() < count * TS_PACKET_SIZE)
+		accepted.resize(count * TS_PACKET_SIZE);
+
+	size_t length = filter.filter(packets, count, &accepted[0]) * TS_PACKET_SIZE;
+	if (length == 0)
+		return;
+
+	/* Where delivery begins once a fast start is done */
+	size_t start = 0;
+	bool started = false;
+	if (starting) {
+		int64_t now = P8PLATFORM::GetTimeMs();
+		if (startDeadline == 0)
+			startDeadline = now + FAST_START_TIMEOUT;
+		else if (now >= startDeadline)
+			started = true;
+	}
+
+	/* A consumer of the whole transport stream gets everything anyway
+	 * and has no time index */
+	timeMarks.clear();
+	if (!urlPids.empty()) {
+		for (size_t i = 0; i < length; i += TS_PACKET_SIZE) {
+			int pid = ((accepted[i + 1] & 0x1f) << 8) | accepted[i + 2];
+
+			/* One lookup into the header for the common packet */
+			if (pid == programMap.pcrPid) {
+				int64_t pcr = tsPcr(&accepted[i]);
+				if (pcr >= 0) {
+					TimeMark mark = { i, pcr, false, (accepted[i + 5] & 0x80) != 0 };
+					timeMarks.push_back(mark);
+				}
+			}
+			if (pid == startPid && (accepted[i + 1] & 0x40) && isRandomAccess(&accepted[i], startKind, startType)) {
+				int64_t pts = tsPesPts(&accepted[i]);
+				if (pts >= 0) {
+					TimeMark mark = { i, pts, true, false };
+					timeMarks.push_back(mark);
+				}
+			}
+
+			if (pid == TS_PID_PAT || pid == pmtPid) {
+				parsePsi(&accepted[i]);
+				if (starting && !started)
+					keepStartPsi(pid, &accepted[i]);
+				/* Neither video nor audio, nothing to wait for */
+				if (starting && !started && programKnown && startPid < 0) {
+					start = i + TS_PACKET_SIZE;
+					started = true;
+				}
+			} else if (starting && !started && pid == startPid && isRandomAccess(&accepted[i], startKind, startType)) {
+				start = i;
+				started = true;
+			}
+		}
+	}
+
+	P8PLATFORM::CLockObject lock(mutex);
+
+	/* Nothing the decoder could start with has been seen yet */
+	if (starting && !started)
+		return;
+
+	/* The PAT and PMT go first, so the player knows the streams before
+	 * the keyframe arrives */
+	if (starting) {
+		starting = false;
+		libKodi->Log(LOG_DEBUG, "%s: %s starts at pid %d", __func__, name.c_str(), startPid);
+
+		buffer->write(startPat.data(), startPat.size());
+		buffer->write(startPmt.data(), startPmt.size());
+		std::vector<uint8_t>().swap(startPat);
+		std::vector<uint8_t>().swap(startPmt);
+	}
+
+	/* Never waits for the reader, a paused or slow one loses the oldest
+	 * data instead */
+	int64_t base = buffer->getEnd() - start;
+	buffer->write(accepted.data() + start, length - start);
+
+	if (!timeMarks.empty()) {
+		for (std::vector<TimeMark>::const_iterator it = timeMarks.begin(); it != timeMarks.end(); ++it) {
+			if (it->offset < start)
+				continue;
+			if (it->keyframe)
+				timeIndex.addKeyframe(it->timestamp, base + it->offset);
+			else
+				timeIndex.add(it->timestamp, it->discontinuity, base + it->offset);
+		}
+		timeIndex.trim(buffer->getStart());
+	}
+
+	if (!readable && position < buffer->getEnd()) {
+		readable = true;
+		condition.Signal();
+	}
+}
+
+void StreamConsumer::keepStartPsi(int pid, const uint8_t *packet)
+{
+	std::vector<uint8_t> &packets = pid == TS_PID_PAT ? startPat : startPmt;
+	if ((packet[1] & 0x40) || packets.size() >= FAST_START_PSI_SIZE)
+		packets.clear();
+
+	packets.insert(packets.end(), packet, packet + TS_PACKET_SIZE);
+}
+
+int StreamConsumer::read(unsigned char *data, unsigned int size, int timeoutMs)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	if (!readable)
+		condition.Wait(mutex, readable, timeoutMs);
+
+	size_t length = 0;
+	int64_t from = position;
+	while (length == 0 && position < buffer->getEnd()) {
+		/* Overwritten data and what never made it to the disk */
+		int64_t next = buffer->getReadable(position);
+		if (next > position) {
+			dropped += (next - position) / TS_PACKET_SIZE;
+			position = next;
+		}
+
+		/* A read from disk must not hold up the session thread */
+		from = position;
+		mutex.Unlock();
+		length = buffer->read(from, data, size);
+		mutex.Lock();
+
+		/* Seeked meanwhile */
+		if (position != from)
+			return 0;
+		position += length;
+	}
+	readable = position < buffer->getEnd();
+
+	if (length > 0) {
+		if (from != readEnd)
+			readJump = from;
+		readEnd = position;
+	}
+
+	/* Caught up with the live stream */
+	if (!readable)
+		timeshifting = false;
+
+	return length;
+}
+
+int64_t StreamConsumer::seek(int64_t offset, int whence)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	int64_t target;
+	switch (whence) {
+	case SEEK_SET:
+		target = offset;
+		break;
+	case SEEK_CUR:
+		target = position + offset;
+		break;
+	case SEEK_END:
+		target = buffer->getEnd() + offset;
+		break;
+	default:
+		return -1;
+	}
+
+	if (target < buffer->getStart() || target > buffer->getEnd())
+		return -1;
+
+	position = target / TS_PACKET_SIZE * TS_PACKET_SIZE;
+	readable = position < buffer->getEnd();
+	timeshifting = readable;
+
+	return position;
+}
+
+void StreamConsumer::pause(bool paused)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	/* Nothing to do but remember, the session keeps writing */
+	if (paused)
+		timeshifting = true;
+}
+
+int64_t StreamConsumer::getPosition(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	return std::max(position, buffer->getStart());
+}
+
+int64_t StreamConsumer::getLength(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	return buffer->getEnd();
+}
+
+bool StreamConsumer::isTimeshifting(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	return timeshifting;
+}
+
+bool StreamConsumer::getTimes(int64_t &begin, int64_t &end, time_t &startTime)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	if (timeIndex.isEmpty())
+		return false;
+
+	begin = timeIndex.front().time * DVD_TIME_BASE / TS_CLOCK_RATE;
+	end = timeIndex.back().time * DVD_TIME_BASE / TS_CLOCK_RATE;
+	startTime = timeIndex.getStartTime();
+	return true;
+}
+
+bool StreamConsumer::seekTime(int64_t timeMs, bool backwards, int64_t &time)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	TsTimeIndex::Entry entry;
+	if (!timeIndex.find(timeMs * TS_CLOCK_RATE / 1000, backwards, entry))
+		return false;
+
+	position = entry.position;
+	readable = position < buffer->getEnd();
+	timeshifting = readable;
+	time = entry.time * DVD_TIME_BASE / TS_CLOCK_RATE;
+
+	return true;
+}
+
+bool StreamConsumer::takeClock(TsClock &clock)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	if (readJump < 0)
+		return false;
+
+	/* Nothing to take over before the first PCR */
+	if (!timeIndex.getClock(readJump, clock))
+		clock.reset();
+	readJump = -1;
+	return true;
+}
+
+bool StreamConsumer::getProgramMap(TsProgramMap &map, int timeoutMs)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	/* A consumer of the whole transport stream does not follow a PMT */
+	if (urlPids.empty())
+		return false;
+
+	if (!programKnown && timeoutMs > 0)
+		programCondition.Wait(mutex, programKnown, timeoutMs);
+	if (!programKnown)
+		return false;
+
+	map = programMap;
+	return true;
+}
+
+StreamSession::StreamSession(OctonetData &data, rtsp_client *rtsp, const std::string &key, const std::string &url, int frontend)
+	: data(data), rtsp(rtsp), key(key), url(url), frontend(frontend), control(*this), users(0),
+	lastTunerSample(time(NULL)), packets(0), lost(0), lastSeq(0)
+{
+}
+
+StreamSession::~StreamSession(void)
+{
+	StopThread();
+	/* A pending request ends with the socket timeout at the latest */
+	control.StopThread(-1);
+	controlEvent.Signal();
+	control.StopThread(0);
+
+	sampleTuner();
+	rtsp_close(rtsp);
+	data.streamClosed(url, frontend);
+}
+
+bool StreamSession::start(void)
+{
+	/* Running before the session is shared, so deleting it stops them */
+	return CreateThread(true) && control.CreateThread(true);
+}
+
+bool StreamSession::addConsumer(StreamConsumer *consumer)
+{
+	P8PLATFORM::CLockObject controlLock(controlMutex);
+
+	std::vector<int> added;
+	const std::vector<int> &pids = consumer->getPids();
+	for (std::vector<int>::const_iterator it = pids.begin(); it != pids.end(); ++it) {
+		if (pidRefs.find(*it) == pidRefs.end())
+			added.push_back(*it);
+	}
+
+	/* The other consumers are served meanwhile. A session whose last
+	 * consumer just left still streams, but its PIDs are forgotten */
+	if (IsRunning() && !added.empty() && !rtsp_update_pids(rtsp, joinPids(added), std::string()))
+		return false;
+
+	P8PLATFORM::CLockObject lock(mutex);
+	for (std::vector<int>::const_iterator it = pids.begin(); it != pids.end(); ++it)
+		pidRefs[*it]++;
+	consumers.push_back(consumer);
+	consumer->session = this;
+
+	return true;
+}
+
+size_t StreamSession::removeConsumer(StreamConsumer *consumer)
+{
+	P8PLATFORM::CLockObject controlLock(controlMutex);
+
+	std::vector<int> removed;
+	size_t left;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		consumers.erase(std::remove(consumers.begin(), consumers.end(), consumer), consumers.end());
+		consumer->session = NULL;
+		left = consumers.size();
+
+		const std::vector<int> &pids = consumer->getPids();
+		for (std::vector<int>::const_iterator it = pids.begin(); it != pids.end(); ++it) {
+			if (--pidRefs[*it] == 0) {
+				pidRefs.erase(*it);
+				removed.push_back(*it);
+			}
+		}
+	}
+
+	/* A session without consumers is torn down anyway */
+	if (left > 0 && !removed.empty())
+		rtsp_update_pids(rtsp, std::string(), joinPids(removed));
+
+	return left;
+}
+
+size_t StreamSession::getConsumerCount(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	return consumers.size();
+}
+
+void StreamSession::updateConsumer(StreamConsumer *consumer)
+{
+	std::vector<int> oldPids, newPids, added, removed;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		oldPids = consumer->pids;
+		newPids = consumer->wantedPids;
+	}
+
+	for (std::vector<int>::const_iterator it = newPids.begin(); it != newPids.end(); ++it) {
+		if (std::find(oldPids.begin(), oldPids.end(), *it) == oldPids.end() && pidRefs.find(*it) == pidRefs.end())
+			added.push_back(*it);
+	}
+	for (std::vector<int>::const_iterator it = oldPids.begin(); it != oldPids.end(); ++it) {
+		if (std::find(newPids.begin(), newPids.end(), *it) == newPids.end() && pidRefs[*it] == 1)
+			removed.push_back(*it);
+	}
+
+	if ((!added.empty() || !removed.empty()) &&
+			!rtsp_update_pids(rtsp, joinPids(added), joinPids(removed))) {
+		P8PLATFORM::CLockObject lock(mutex);
+		libKodi->Log(LOG_ERROR, "%s: %s pids %s refused, retrying in %d seconds", __func__,
+				consumer->getName().c_str(), joinPids(newPids).c_str(), consumer->pidsBackoff);
+		/* pidsChanged stays set */
+		consumer->pidsRetry = time(NULL) + consumer->pidsBackoff;
+		consumer->pidsBackoff = std::min(2 * consumer->pidsBackoff, PIDS_RETRY_MAX);
+		return;
+	}
+
+	libKodi->Log(LOG_DEBUG, "%s: %s pids %s, added %s, removed %s", __func__, consumer->getName().c_str(),
+			joinPids(newPids).c_str(), joinPids(added).c_str(), joinPids(removed).c_str());
+
+	P8PLATFORM::CLockObject lock(mutex);
+	for (std::vector<int>::const_iterator it = oldPids.begin(); it != oldPids.end(); ++it) {
+		if (--pidRefs[*it] == 0)
+			pidRefs.erase(*it);
+	}
+	for (std::vector<int>::const_iterator it = newPids.begin(); it != newPids.end(); ++it)
+		pidRefs[*it]++;
+
+	consumer->pids = newPids;
+	consumer->filter.set(newPids);
+	/* A newer PMT may have arrived during the request */
+	consumer->pidsChanged = consumer->wantedPids != newPids;
+	consumer->pidsRetry = 0;
+	consumer->pidsBackoff = PIDS_RETRY_MIN;
+}
+
+void StreamSession::sendRequests(void)
+{
+	P8PLATFORM::CLockObject controlLock(controlMutex);
+
+	/* Consumers are only removed with controlMutex held */
+	std::vector<StreamConsumer*> changed;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		time_t now = time(NULL);
+		for (std::vector<StreamConsumer*>::iterator it = consumers.begin(); it != consumers.end(); ++it) {
+			if ((*it)->pidsChanged && (*it)->pidsRetry <= now)
+				changed.push_back(*it);
+		}
+	}
+
+	for (std::vector<StreamConsumer*>::iterator it = changed.begin(); it != changed.end(); ++it)
+		updateConsumer(*it);
+
+	rtsp_keepalive(rtsp);
+}
+
+void *StreamControl::Process(void)
+{
+	while (!IsStopped()) {
+		session.sendRequests();
+		session.controlEvent.Wait(SESSION_CONTROL_INTERVAL);
+	}
+
+	return NULL;
+}
+
+void StreamSession::sampleTuner(void)
+{
+	int fe, level, quality;
+
+	lastTunerSample = time(NULL);
+	if (rtsp_get_tuner_status(rtsp, fe, level, quality))
+		data.streamStatus(url, fe, level, quality);
+}
+
+void StreamSession::fillSignalStatus(PVR_SIGNAL_STATUS &status)
+{
+	rtsp_fill_signal_status(rtsp, status);
+}
+
+size_t StreamSession::receive(unsigned char *batch, size_t size)
+{
+	unsigned char buffer[RTP_PACKET_SIZE];
+	size_t used = 0;
+	int timeout = SESSION_READ_TIMEOUT;
+
+	/* Whatever is queued already is taken in one go, so consumers are
+	 * woken up once per batch instead of once per RTP packet */
+	while (used + RTP_PACKET_SIZE <= size) {
+		int length = rtsp_read(rtsp, buffer, sizeof(buffer), timeout);
+		if (length <= 0)
+			break;
+		timeout = 0;
+
+		if (length < RTP_HEADER_SIZE || (buffer[0] >> 6) != 2)
+			continue;
+
+		/* Skip the RTP header including CSRCs and extension */
+		size_t offset = RTP_HEADER_SIZE + 4 * (buffer[0] & 0x0f);
+		if ((buffer[0] & 0x10) && offset + 4 <= (size_t)length)
+			offset += 4 + 4 * ((buffer[offset + 2] << 8) | buffer[offset + 3]);
+		if ((buffer[0] & 0x20) && buffer[length - 1] <= length)
+			length -= buffer[length - 1];
+
+		uint16_t seq = (buffer[2] << 8) | buffer[3];
+		if (packets > 0 && seq != (uint16_t)(lastSeq + 1))
+			lost += (uint16_t)(seq - lastSeq - 1);
+		lastSeq = seq;
+		packets++;
+
+		if (offset < (size_t)length) {
+			size_t payload = (length - offset) / TS_PACKET_SIZE * TS_PACKET_SIZE;
+			memcpy(batch + used, buffer + offset, payload);
+			used += payload;
+		}
+	}
+
+	return used;
+}
+
+void *StreamSession::Process(void)
+{
+	std::vector<unsigned char> batch(SESSION_BATCH_SIZE);
+
+	while (!IsStopped()) {
+		size_t length = receive(&batch[0], batch.size());
+
+		if (length > 0) {
+			P8PLATFORM::CLockObject lock(mutex);
+			bool pidsChanged = false;
+			for (std::vector<StreamConsumer*>::iterator it = consumers.begin(); it != consumers.end(); ++it) {
+				(*it)->push(&batch[0], length / TS_PACKET_SIZE);
+				pidsChanged |= (*it)->pidsChanged && (*it)->pidsRetry == 0;
+			}
+
+			/* Requested by the control thread, the receiver keeps
+			 * draining the socket meanwhile. Retries after a refusal
+			 * wait for its next round */
+			if (pidsChanged)
+				controlEvent.Signal();
+		}
+
+		if (time(NULL) >= lastTunerSample + TUNER_SAMPLE_INTERVAL)
+			sampleTuner();
+	}
+
+	return NULL;
+}
+
+void StreamSession::logDiagnostics(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	libKodi->Log(LOG_NOTICE, "diagnostics: session %s frontend %d, %zu consumers, %zu pids, %zu rtp packets, %zu lost",
+			url.c_str(), frontend, consumers.size(), pidRefs.size(), packets, lost);
+	for (std::vector<StreamConsumer*>::const_iterator it = consumers.begin(); it != consumers.end(); ++it) {
+		StreamConsumer *consumer = *it;
+		P8PLATFORM::CLockObject consumerLock(consumer->mutex);
+		const StreamBuffer &buffer = *consumer->buffer;
+		libKodi->Log(LOG_NOTICE, "diagnostics: consumer %s, %zu pids, %lld of %llu bytes buffered%s, %lld behind live, %zu packets dropped",
+				consumer->getName().c_str(), consumer->getPids().size(),
+				(long long)(buffer.getEnd() - buffer.getStart()), (unsigned long long)buffer.getSize(),
+				buffer.getDirectory().empty() ? (buffer.usesHugePages() ? " in huge pages" : "") : " on disk",
+				(long long)(buffer.getEnd() - std::max(consumer->position, buffer.getStart())), consumer->dropped);
+	}
+}
+
+SessionManager::SessionManager(OctonetData &data)
+	: data(data), fastStart(true), timeshiftSize(0), spareBuffer(NULL)
+{
+}
+
+SessionManager::~SessionManager(void)
+{
+	for (std::vector<StreamSession*>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+		delete *it;
+	delete spareBuffer;
+}
+
+StreamBuffer *SessionManager::takeBuffer(bool recording)
+{
+	if (recording)
+		return new StreamBuffer(RECORDING_BUFFER_SIZE);
+
+	uint64_t size;
+	std::string directory;
+	StreamBuffer *buffer;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		size = timeshiftSize > 0 ? timeshiftSize : CONSUMER_BUFFER_SIZE;
+		directory = timeshiftSize > 0 ? timeshiftDirectory : std::string();
+
+		/* Faulting in a big buffer takes a while, zapping reuses the last one */
+		buffer = spareBuffer;
+		spareBuffer = NULL;
+	}
+	if (buffer != NULL && buffer->matches(size, directory)) {
+		buffer->clear();
+		return buffer;
+	}
+
+	delete buffer;
+	if (!directory.empty())
+		return new StreamBuffer(directory, size);
+	return new StreamBuffer((size_t)size);
+}
+
+void SessionManager::recycleBuffer(StreamBuffer *buffer)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	uint64_t size = timeshiftSize > 0 ? timeshiftSize : CONSUMER_BUFFER_SIZE;
+	std::string directory = timeshiftSize > 0 ? timeshiftDirectory : std::string();
+	/* Segment files are cheap to set up again, and a big ring would
+	 * stay allocated for as long as nothing is played */
+	if (!buffer->matches(size, directory) || !buffer->getDirectory().empty() || buffer->getSize() > SPARE_BUFFER_MAX) {
+		delete buffer;
+		return;
+	}
+
+	delete spareBuffer;
+	spareBuffer = buffer;
+}
+
+StreamSession *SessionManager::findSession(const std::string &key)
+{
+	if (key.empty())
+		return NULL;
+
+	for (std::vector<StreamSession*>::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+		if ((*it)->getKey() == key)
+			return *it;
+	}
+
+	return NULL;
+}
+
+StreamSession *SessionManager::acquireSession(const std::string &key)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	StreamSession *session = findSession(key);
+	if (session != NULL)
+		session->users++;
+	return session;
+}
+
+void SessionManager::releaseSession(StreamSession *session)
+{
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+
+		/* Another open or close still works on it, or it got a new consumer */
+		if (--session->users > 0 || session->getConsumerCount() > 0)
+			return;
+		sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
+	}
+
+	/* Joins the threads and sends the TEARDOWN */
+	delete session;
+}
+
+StreamConsumer *SessionManager::newConsumer(const std::string &name, const std::string &url, bool recording)
+{
+	bool keyframeStart;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		keyframeStart = fastStart || recording;
+	}
+
+	return new StreamConsumer(name, url, keyframeStart, takeBuffer(recording));
+}
+
+void SessionManager::setFastStart(bool enabled)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	fastStart = enabled;
+}
+
+void SessionManager::setTimeshift(uint64_t size, const std::string &directory)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	timeshiftSize = size;
+	timeshiftDirectory = directory;
+
+	delete spareBuffer;
+	spareBuffer = NULL;
+}
+
+StreamConsumer *SessionManager::open(int channelId, bool recording)
+{
+	std::string name = data.getName(channelId);
+	std::vector<std::string> urls = data.getUrls(channelId);
+
+	/* Another consumer on the same transponder needs no extra tuner */
+	for (std::vector<std::string>::const_iterator it = urls.begin(); it != urls.end(); ++it) {
+		StreamSession *session = acquireSession(tuningKey(*it));
+		if (session == NULL)
+			continue;
+
+		StreamConsumer *consumer = newConsumer(name, *it, recording);
+		bool added = session->addConsumer(consumer);
+		if (added)
+			libKodi->Log(LOG_DEBUG, "%s: %s shares session %s", __func__, name.c_str(), session->getKey().c_str());
+		releaseSession(session);
+		if (added)
+			return consumer;
+
+		recycleBuffer(consumer->getBuffer());
+		delete consumer;
+	}
+
+	/* A server which refuses the stream anyway falls through to the next */
+	urls = data.admitUrls(urls);
+	for (std::vector<std::string>::const_iterator it = urls.begin(); it != urls.end(); ++it) {
+		int frontend = data.pickFrontend(*it);
+		rtsp_client *rtsp = NULL;
+
+		if (frontend != 0) {
+			std::stringstream pinned;
+			pinned << *it << "&fe=" << frontend;
+			rtsp = rtsp_open(name, pinned.str());
+			if (rtsp == NULL) {
+				data.frontendFailed(*it, frontend);
+				frontend = 0;
+			}
+		}
+
+		if (rtsp == NULL)
+			rtsp = rtsp_open(name, *it);
+		if (rtsp == NULL)
+			continue;
+
+		data.streamOpened(*it, frontend);
+
+		StreamConsumer *consumer = newConsumer(name, *it, recording);
+		StreamSession *session = new StreamSession(data, rtsp, tuningKey(*it), *it, frontend);
+		if (!session->addConsumer(consumer) || !session->start()) {
+			libKodi->Log(LOG_ERROR, "%s: could not start the session for %s", __func__, name.c_str());
+			delete session;
+			recycleBuffer(consumer->getBuffer());
+			delete consumer;
+			continue;
+		}
+
+		P8PLATFORM::CLockObject lock(mutex);
+		sessions.push_back(session);
+		return consumer;
+	}
+
+	if (urls.empty())
+		libKodi->Log(LOG_ERROR, "%s: no tuner available for %s", __func__, name.c_str());
+
+	return NULL;
+}
+
+void SessionManager::close(StreamConsumer *consumer)
+{
+	/* Its consumer keeps the session alive until here */
+	StreamSession *session = consumer->getSession();
+	if (session != NULL) {
+		{
+			P8PLATFORM::CLockObject lock(mutex);
+			session->users++;
+		}
+		session->removeConsumer(consumer);
+		releaseSession(session);
+	}
+
+	recycleBuffer(consumer->getBuffer());
+	delete consumer;
+}
+
+void SessionManager::fillSignalStatus(StreamConsumer *consumer, PVR_SIGNAL_STATUS &status)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	if (consumer->getSession() != NULL)
+		consumer->getSession()->fillSignalStatus(status);
+	strncpy(status.strServiceName, consumer->getName().c_str(), PVR_ADDON_NAME_STRING_LENGTH - 1);
+}
+
+bool SessionManager::fillStreamProperties(StreamConsumer *consumer, PVR_STREAM_PROPERTIES &properties)
+{
+	TsProgramMap map;
+	if (!consumer->getProgramMap(map, STREAM_PROPERTIES_TIMEOUT))
+		return false;
+
+	return fillStreamProperties(map, properties);
+}
+
+bool SessionManager::fillStreamProperties(const TsProgramMap &map, PVR_STREAM_PROPERTIES &properties)
+{
+	properties.iStreamCount = 0;
+	for (std::vector<TsElementaryStream>::const_iterator it = map.streams.begin(); it != map.streams.end(); ++it) {
+		if (it->codec == NULL || properties.iStreamCount >= PVR_STREAM_MAX_STREAMS)
+			continue;
+
+		xbmc_codec_t codec = pvr->GetCodecByName(it->codec);
+		if (codec.codec_type == XBMC_CODEC_TYPE_UNKNOWN)
+			continue;
+
+		PVR_STREAM_PROPERTIES::PVR_STREAM &stream = properties.stream[properties.iStreamCount++];
+		memset(&stream, 0, sizeof(stream));
+		stream.iPID = it->pid;
+		stream.iCodecType = codec.codec_type;
+		stream.iCodecId = codec.codec_id;
+		strncpy(stream.strLanguage, it->language.c_str(), sizeof(stream.strLanguage) - 1);
+		if (it->kind == TS_STREAM_SUBTITLE)
+			stream.iSubtitleInfo = (it->compositionPage & 0xffff) | (it->ancillaryPage << 16);
+	}
+
+	return properties.iStreamCount > 0;
+}
+
+void SessionManager::logDiagnostics(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	libKodi->Log(LOG_NOTICE, "diagnostics: %zu stream sessions", sessions.size());
+	for (std::vector<StreamSession*>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+		(*it)->logDiagnostics();
+}
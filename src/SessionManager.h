@@ -0,0 +1,302 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include <p8-platform/threads/mutex.h>
+#include <p8-platform/threads/threads.h>
+#include <xbmc_pvr_types.h>
+
+#include "StreamBuffer.h"
+#include "TsPidFilter.h"
+#include "TsPsi.h"
+#include "TsTimeIndex.h"
+
+class OctonetData;
+class StreamSession;
+struct rtsp_client;
+
+/*
+ * One reader of a stream, e.g. live TV. Gets the TS packets of its own
+ * PIDs out of a session that may carry further services of the same
+ * transponder for other consumers.
+ */
+class StreamConsumer
+{
+	public:
+		/* With fastStart nothing is delivered before the PAT, the PMT
+		 * and the first keyframe of the service. Everything still in
+		 * the buffer, which is not owned, can be read again */
+		StreamConsumer(const std::string &name, const std::string &url, bool fastStart, StreamBuffer *buffer);
+
+		/* Waits up to timeoutMs for data, 0 if none arrived */
+		int read(unsigned char *data, unsigned int size, int timeoutMs);
+		/* Moves the read position within the buffered part of the
+		 * stream, -1 if the target is not buffered */
+		int64_t seek(int64_t offset, int whence);
+		void pause(bool paused);
+		int64_t getPosition(void);
+		int64_t getLength(void);
+		/* Paused or behind the live stream since a seek */
+		bool isTimeshifting(void);
+		/* Stream times of the oldest and newest buffered data in
+		 * microseconds since the first PCR, false before the first PCR */
+		bool getTimes(int64_t &begin, int64_t &end, time_t &startTime);
+		/* Moves the read position to the keyframe before or after
+		 * timeMs since the first PCR, time is set to the one chosen */
+		bool seekTime(int64_t timeMs, bool backwards, int64_t &time);
+		/* If the last read did not continue the one before, e.g. after
+		 * a seek, the clock of the time index where its data starts.
+		 * A demuxer taking it over has the same stream times */
+		bool takeClock(TsClock &clock);
+
+		const std::string& getName(void) const { return name; }
+		const std::string& getUrl(void) const { return url; }
+		/* Empty if the URL does not list PIDs, the consumer then takes
+		 * everything and cannot share its session */
+		const std::vector<int>& getPids(void) const { return pids; }
+		StreamSession* getSession(void) const { return session; }
+		StreamBuffer* getBuffer(void) const { return buffer; }
+		/* Waits up to timeoutMs for the PMT of the service, false if it
+		 * is not known. A timeout of 0 does not wait */
+		bool getProgramMap(TsProgramMap &map, int timeoutMs);
+
+	private:
+		friend class StreamSession;
+
+		struct TimeMark
+		{
+			/* Into accepted */
+			size_t offset;
+			/* PCR or PTS */
+			int64_t timestamp;
+			bool keyframe;
+			bool discontinuity;
+		};
+
+		/* Called by the session for every received batch */
+		void push(const unsigned char *packets, size_t count);
+		/* Follows PAT and PMT of the service to find the PIDs it
+		 * actually needs */
+		void parsePsi(const uint8_t *packet);
+		void keepStartPsi(int pid, const uint8_t *packet);
+
+		std::string name;
+		std::string url;
+		/* As requested by the URL and currently requested */
+		std::vector<int> urlPids;
+		std::vector<int> pids;
+		TsPidFilter filter;
+
+		/* Only touched by the session thread */
+		TsSectionAssembler patAssembler;
+		TsSectionAssembler pmtAssembler;
+		int pmtPid;
+		/* Set when the PMT asks for other PIDs than requested, read by
+		 * the control thread with the session mutex held */
+		bool pidsChanged;
+		std::vector<int> wantedPids;
+		/* A refused PID change is retried no earlier than this, with
+		 * the delay doubling on each failure */
+		time_t pidsRetry;
+		int pidsBackoff;
+		/* Fast start state, the stream is held back while starting */
+		bool starting;
+		int64_t startDeadline;
+		/* The video, or the audio of radio. Its random access points
+		 * are where the stream is started and where seeks go to */
+		int startPid;
+		TsStreamKind startKind;
+		int startType;
+		std::vector<uint8_t> startPat;
+		std::vector<uint8_t> startPmt;
+		/* Accepted packets of the current push and the PCRs and
+		 * keyframes among them, only used by the session thread */
+		std::vector<uint8_t> accepted;
+		std::vector<TimeMark> timeMarks;
+
+		P8PLATFORM::CMutex mutex;
+		/* Written by the session thread with the mutex held */
+		TsProgramMap programMap;
+		P8PLATFORM::CCondition<bool> programCondition;
+		bool programKnown;
+		P8PLATFORM::CCondition<bool> condition;
+		bool readable;
+		StreamBuffer *buffer;
+		/* PCRs of the service in the buffer */
+		TsTimeIndex timeIndex;
+		/* Stream position of the next read */
+		int64_t position;
+		/* Where the last read ended and where the last one not
+		 * continuing it started, -1 once taken */
+		int64_t readEnd;
+		int64_t readJump;
+		bool timeshifting;
+		size_t dropped;
+
+		StreamSession *session;
+};
+
+/*
+ * Sends the RTSP requests of a session, so the receiver never waits for
+ * an answer of the server
+ */
+class StreamControl : public P8PLATFORM::CThread
+{
+	public:
+		explicit StreamControl(StreamSession &session) : session(session) {}
+
+	protected:
+		virtual void *Process(void);
+
+	private:
+		StreamSession &session;
+};
+
+/*
+ * One RTSP session, i.e. one tuned frontend, feeding any number of
+ * consumers. The PIDs requested from the server are the union of the PIDs
+ * of all consumers.
+ */
+class StreamSession : public P8PLATFORM::CThread
+{
+	public:
+		StreamSession(OctonetData &data, rtsp_client *rtsp, const std::string &key, const std::string &url, int frontend);
+		virtual ~StreamSession(void);
+
+		const std::string& getKey(void) const { return key; }
+
+		/* The first consumer is served by the PIDs of the SETUP, later
+		 * ones have their PIDs added to the running stream */
+		bool addConsumer(StreamConsumer *consumer);
+		/* Returns the number of consumers left */
+		size_t removeConsumer(StreamConsumer *consumer);
+		size_t getConsumerCount(void);
+		/* Starts the receiver and the control thread */
+		bool start(void);
+
+		void fillSignalStatus(PVR_SIGNAL_STATUS &status);
+		void logDiagnostics(void);
+
+	protected:
+		virtual void *Process(void);
+
+	private:
+		friend class StreamControl;
+		friend class SessionManager;
+
+		/* Collects the TS payload of the queued RTP packets */
+		size_t receive(unsigned char *batch, size_t size);
+		void sampleTuner(void);
+		/* Run by the control thread, sends the pending PID changes and
+		 * the keepalive */
+		void sendRequests(void);
+		/* Request the PIDs the consumer wants now, needs controlMutex */
+		void updateConsumer(StreamConsumer *consumer);
+
+		OctonetData &data;
+		rtsp_client *rtsp;
+		std::string key;
+		std::string url;
+		int frontend;
+
+		/* Serializes the RTSP control connection. Taken before mutex,
+		 * never by the receiver */
+		P8PLATFORM::CMutex controlMutex;
+		P8PLATFORM::CEvent controlEvent;
+		StreamControl control;
+
+		/* Opens and closes working on the session outside the manager
+		 * mutex, only changed with that held */
+		int users;
+
+		/* Guards the consumers against the receiver. They and pidRefs
+		 * are only changed with both mutexes held */
+		P8PLATFORM::CMutex mutex;
+		std::vector<StreamConsumer*> consumers;
+		std::map<int, int> pidRefs;
+
+		time_t lastTunerSample;
+		size_t packets;
+		size_t lost;
+		uint16_t lastSeq;
+};
+
+/*
+ * Hands out streams, reusing a running session if another consumer is on
+ * the same transponder of the same server already.
+ */
+class SessionManager
+{
+	public:
+		explicit SessionManager(OctonetData &data);
+		~SessionManager(void);
+
+		/* Apply to streams opened afterwards */
+		void setFastStart(bool enabled);
+		/* 0 disables timeshift, the buffer is kept in segment files
+		 * if a directory is given */
+		void setTimeshift(uint64_t size, const std::string &directory);
+
+		/* NULL if no server could provide the channel. A recording
+		 * always starts at a keyframe and gets a buffer of its own
+		 * instead of the timeshift one */
+		StreamConsumer *open(int channelId, bool recording = false);
+		void close(StreamConsumer *consumer);
+
+		void fillSignalStatus(StreamConsumer *consumer, PVR_SIGNAL_STATUS &status);
+		/* Streams of the service as announced by its PMT, false if
+		 * they are not known yet */
+		bool fillStreamProperties(StreamConsumer *consumer, PVR_STREAM_PROPERTIES &properties);
+		/* Streams of a PMT known otherwise, e.g. from a recording */
+		static bool fillStreamProperties(const TsProgramMap &map, PVR_STREAM_PROPERTIES &properties);
+		void logDiagnostics(void);
+
+	private:
+		StreamSession *findSession(const std::string &key);
+		/* The session of the key, kept until released even if its last
+		 * consumer leaves meanwhile */
+		StreamSession *acquireSession(const std::string &key);
+		/* Deletes the session once nobody uses it anymore */
+		void releaseSession(StreamSession *session);
+		StreamConsumer *newConsumer(const std::string &name, const std::string &url, bool recording);
+		StreamBuffer *takeBuffer(bool recording);
+		/* Keeps the buffer of a closed stream for the next one if it
+		 * fits the current settings and is in memory and not too big */
+		void recycleBuffer(StreamBuffer *buffer);
+
+		OctonetData &data;
+		/* Only held to look up or change the sessions, the spare buffer
+		 * and the settings, never across RTSP requests */
+		P8PLATFORM::CMutex mutex;
+		std::vector<StreamSession*> sessions;
+		bool fastStart;
+		uint64_t timeshiftSize;
+		std::string timeshiftDirectory;
+		StreamBuffer *spareBuffer;
+};
@@ -31,6 +31,7 @@ namespace OCTO
 
 /* Master defines for client control */
 #define RECEIVE_TIMEOUT 6 //sec
+#define CONNECT_TIMEOUT 3 //sec
 
 Socket::Socket(const enum SocketFamily family, const enum SocketDomain domain, const enum SocketType type, const enum SocketProtocol protocol)
 {
@@ -332,6 +333,25 @@ bool Socket::ReadLine (string& line)
 }
 
 
+bool Socket::wait_readable ( int timeout_ms ) const
+{
+  fd_set set_r;
+  timeval timeout;
+
+  if ( !is_valid() )
+  {
+    return false;
+  }
+
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+  FD_ZERO(&set_r);
+  FD_SET(_sd, &set_r);
+
+  return select(_sd + 1, &set_r, NULL, NULL, &timeout) > 0;
+}
+
 int Socket::receive ( std::string& data) const
 {
   char buf[MAXRECV + 1];
@@ -368,6 +388,10 @@ int Socket::receive ( char* data, const unsigned int buffersize, const unsigned
       return status;
     }
 
+    // Connection closed by the peer
+    if ( status == 0 )
+      break;
+
     receivedsize += status;
   }
 
@@ -423,8 +447,7 @@ bool Socket::connect ( const std::string& host, const unsigned short port )
       continue;
     }
 
-    int status = ::connect(_sd, address->ai_addr, address->ai_addrlen);
-    if (status == SOCKET_ERROR)
+    if (!connect_timeout(address->ai_addr, address->ai_addrlen, CONNECT_TIMEOUT * 1000))
     {
       close();
       continue;
@@ -444,9 +467,53 @@ bool Socket::connect ( const std::string& host, const unsigned short port )
     return false;
   }
 
+  // An unresponsive server must not hang the caller
+  set_timeout(RECEIVE_TIMEOUT * 1000);
+
   return true;
 }
 
+bool Socket::connect_timeout ( const struct sockaddr* addr, socklen_t addrlen, int timeout_ms )
+{
+  if ( !set_non_blocking(true) )
+    return false;
+
+  if ( ::connect(_sd, addr, addrlen) == SOCKET_ERROR )
+  {
+    int err = getLastError();
+#if defined(TARGET_WINDOWS)
+    if ( err != WSAEWOULDBLOCK )
+#else
+    if ( err != EINPROGRESS )
+#endif
+      return false;
+
+    fd_set set_w, set_e;
+    timeval timeout;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    FD_ZERO(&set_w);
+    FD_ZERO(&set_e);
+    FD_SET(_sd, &set_w);
+    FD_SET(_sd, &set_e);
+
+    if ( select(_sd + 1, NULL, &set_w, &set_e, &timeout) <= 0 )
+    {
+      libKodi->Log(LOG_DEBUG, "Socket::connect timed out after %d ms", timeout_ms);
+      return false;
+    }
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if ( getsockopt(_sd, SOL_SOCKET, SO_ERROR, (char*)&error, &len) != 0 || error != 0 )
+      return false;
+  }
+
+  return set_non_blocking(false);
+}
+
 bool Socket::reconnect()
 {
   if ( is_valid() )
@@ -463,6 +530,14 @@ bool Socket::is_valid() const
 }
 
 #if defined(TARGET_WINDOWS)
+bool Socket::set_timeout ( int timeout_ms )
+{
+  DWORD timeout = timeout_ms;
+
+  return setsockopt(_sd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)) == 0 &&
+    setsockopt(_sd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout)) == 0;
+}
+
 bool Socket::set_non_blocking ( const bool b )
 {
   u_long iMode;
@@ -605,6 +680,17 @@ void Socket::osCleanup()
 }
 
 #elif defined TARGET_LINUX || defined TARGET_DARWIN || defined TARGET_FREEBSD
+bool Socket::set_timeout ( int timeout_ms )
+{
+  timeval timeout;
+
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+  return setsockopt(_sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+    setsockopt(_sd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
 bool Socket::set_non_blocking ( const bool b )
 {
   int opts;
@@ -274,6 +274,20 @@ class Socket
 
     bool set_non_blocking ( const bool );
 
+    /*!
+     * Limit how long a single send or receive may block
+     * \param timeout_ms    Maximum time in milliseconds, 0 to block forever
+     * \return    true if successful
+     */
+    bool set_timeout ( int timeout_ms );
+
+    /*!
+     * Wait until data can be read from the socket
+     * \param timeout_ms    Maximum time to wait in milliseconds
+     * \return    true if data is available, false on timeout or error
+     */
+    bool wait_readable ( int timeout_ms ) const;
+
     bool ReadLine (std::string& line);
 
     bool is_valid() const;
@@ -296,6 +310,7 @@ class Socket
       static int win_usage_count;       ///< Internal Windows usage counter used to prevent a global WSACleanup when more than one Socket object is used
     #endif
 
+    bool connect_timeout ( const struct sockaddr* addr, socklen_t addrlen, int timeout_ms );
     void errormessage( int errornum, const char* functionname = NULL) const;
     int getLastError(void) const;
     bool osInit();
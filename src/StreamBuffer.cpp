@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+#ifndef TARGET_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "StreamBuffer.h"
+#include "TsPidFilter.h"
+#include "client.h"
+
+using namespace ADDON;
+
+#define BUFFER_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define BUFFER_PAGE_SIZE 4096
+/* Smaller rings are plain heap memory */
+#define BUFFER_MAP_MIN (16 * 1024 * 1024)
+/* 47 MiB, whole packets as well as whole pages */
+#define BUFFER_SEGMENT_SIZE (TS_PACKET_SIZE * BUFFER_PAGE_SIZE * 64)
+/* Newest 30 MiB of a ring on disk kept in memory, lets the disk stall for
+ * some seconds without losing data */
+#define BUFFER_STAGING_SIZE (TS_PACKET_SIZE * BUFFER_PAGE_SIZE * 40)
+/* The disk gets written in blocks of 3 MiB, whole packets so no packet is
+ * split by a gap */
+#define BUFFER_WRITE_SIZE (TS_PACKET_SIZE * BUFFER_PAGE_SIZE * 4)
+/* How long the writer waits for a full block before looking again */
+#define BUFFER_WRITE_TIMEOUT 1000
+/* What is kept in memory where segment files are not supported */
+#define BUFFER_DISK_FALLBACK_SIZE (64 * 1024 * 1024)
+
+void *StreamBufferWriter::Process(void)
+{
+	while (!IsStopped()) {
+		if (!buffer.store())
+			buffer.writeEvent.Wait(BUFFER_WRITE_TIMEOUT);
+	}
+
+	return NULL;
+}
+
+StreamBuffer::StreamBuffer(size_t size)
+	: size(size / TS_PACKET_SIZE * TS_PACKET_SIZE), memory(NULL), memorySize(this->size), mapped(0),
+	hugePages(false), written(0), segmentSize(0), stored(0), writer(*this)
+{
+	allocate();
+}
+
+StreamBuffer::StreamBuffer(const std::string &directory, uint64_t size)
+	: directory(directory), memory(NULL), memorySize(BUFFER_STAGING_SIZE), mapped(0),
+	hugePages(false), written(0), segmentSize(BUFFER_SEGMENT_SIZE), stored(0), writer(*this)
+{
+#ifdef TARGET_WINDOWS
+	libKodi->Log(LOG_ERROR, "%s: timeshift on disk is not supported, keeping %d MiB in memory", __func__, BUFFER_DISK_FALLBACK_SIZE >> 20);
+	this->directory.clear();
+	this->size = BUFFER_DISK_FALLBACK_SIZE / TS_PACKET_SIZE * TS_PACKET_SIZE;
+	memorySize = this->size;
+	segmentSize = 0;
+	allocate();
+#else
+	size_t count = std::max((size + segmentSize - 1) / segmentSize, (uint64_t)2);
+	files.assign(count, -1);
+	this->size = (uint64_t)count * segmentSize;
+
+	libKodi->CreateDirectory(directory.c_str());
+	allocate();
+	/* Running before the constructor returns, so a buffer deleted right
+	 * away still stops it */
+	if (memory != NULL)
+		writer.CreateThread(true);
+#endif
+}
+
+StreamBuffer::~StreamBuffer(void)
+{
+	if (!directory.empty()) {
+		writer.StopThread(-1);
+		writeEvent.Signal();
+		writer.StopThread(0);
+	}
+
+#ifndef TARGET_WINDOWS
+	for (size_t i = 0; i < files.size(); i++) {
+		if (files[i] >= 0)
+			close(files[i]);
+		libKodi->DeleteFile(getSegmentPath(i).c_str());
+	}
+
+	if (mapped > 0) {
+		munmap(memory, mapped);
+		return;
+	}
+#endif
+	delete[] memory;
+}
+
+bool StreamBuffer::matches(uint64_t size, const std::string &directory) const
+{
+	if (directory != this->directory)
+		return false;
+
+	if (directory.empty())
+		return size / TS_PACKET_SIZE * TS_PACKET_SIZE == this->size;
+	return std::max((size + segmentSize - 1) / segmentSize, (uint64_t)2) * segmentSize == this->size;
+}
+
+void StreamBuffer::clear(void)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+	written = 0;
+	stored = 0;
+	gaps.clear();
+}
+
+void StreamBuffer::allocate(void)
+{
+#ifndef TARGET_WINDOWS
+	if (memorySize >= BUFFER_MAP_MIN) {
+		size_t length = (memorySize + BUFFER_HUGE_PAGE_SIZE - 1) / BUFFER_HUGE_PAGE_SIZE * BUFFER_HUGE_PAGE_SIZE;
+		void *map = MAP_FAILED;
+
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+		/* Only works if the administrator reserved huge pages */
+		map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+		hugePages = map != MAP_FAILED;
+#endif
+
+		if (map == MAP_FAILED) {
+			map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (map != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+				/* Transparent huge pages, before the pages get faulted in */
+				madvise(map, length, MADV_HUGEPAGE);
+#endif
+				bool populated = false;
+#ifdef MADV_POPULATE_WRITE
+				populated = madvise(map, length, MADV_POPULATE_WRITE) == 0;
+#endif
+				for (size_t i = 0; !populated && i < length; i += BUFFER_PAGE_SIZE)
+					((volatile uint8_t*)map)[i] = 0;
+			}
+		}
+
+		if (map != MAP_FAILED) {
+			memory = (uint8_t*)map;
+			mapped = length;
+			libKodi->Log(LOG_DEBUG, "%s: mapped %zu bytes%s", __func__, length, hugePages ? " of huge pages" : "");
+		}
+	}
+#endif
+
+	if (memory == NULL)
+		memory = new (std::nothrow) uint8_t[memorySize];
+	if (memory == NULL) {
+		libKodi->Log(LOG_ERROR, "%s: cannot allocate %zu bytes", __func__, memorySize);
+		size = 0;
+		memorySize = 0;
+	}
+}
+
+std::string StreamBuffer::getSegmentPath(size_t index) const
+{
+	std::stringstream path;
+	path << directory << "/timeshift-" << index << ".ts";
+	return path.str();
+}
+
+bool StreamBuffer::openSegment(size_t index)
+{
+#ifdef TARGET_WINDOWS
+	return false;
+#else
+	if (files[index] >= 0)
+		return true;
+
+	std::string path = getSegmentPath(index);
+	int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		libKodi->Log(LOG_ERROR, "%s: cannot open %s", __func__, path.c_str());
+		return false;
+	}
+
+	/* Allocated in one go, so the segment stays contiguous on disk and a
+	 * full disk shows up here. Segments of an earlier stream are reused
+	 * as they are */
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)segmentSize) {
+#ifdef TARGET_DARWIN
+		int error = ftruncate(fd, segmentSize) == 0 ? 0 : errno;
+#else
+		int error = posix_fallocate(fd, 0, segmentSize);
+#endif
+		if (error != 0) {
+			libKodi->Log(LOG_ERROR, "%s: cannot allocate %s: %s", __func__, path.c_str(), strerror(error));
+			close(fd);
+			unlink(path.c_str());
+			return false;
+		}
+	}
+
+	files[index] = fd;
+	return true;
+#endif
+}
+
+void StreamBuffer::addGap(int64_t begin, int64_t end)
+{
+	/* Whole packets, a reader resumes at the next one */
+	begin = begin / TS_PACKET_SIZE * TS_PACKET_SIZE;
+	end = (end + TS_PACKET_SIZE - 1) / TS_PACKET_SIZE * TS_PACKET_SIZE;
+
+	std::map<int64_t, int64_t>::iterator last = gaps.empty() ? gaps.end() : --gaps.end();
+	if (last != gaps.end() && last->second >= begin && last->first <= begin)
+		last->second = std::max(last->second, end);
+	else
+		gaps[begin] = end;
+
+	/* Forget about what the ring dropped anyway */
+	while (!gaps.empty() && gaps.begin()->second <= getStart())
+		gaps.erase(gaps.begin());
+}
+
+bool StreamBuffer::store(void)
+{
+#ifdef TARGET_WINDOWS
+	return false;
+#else
+	int64_t begin, end;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+
+		int64_t memoryStart = getMemoryStart();
+		if (stored < memoryStart) {
+			libKodi->Log(LOG_ERROR, "%s: disk too slow, lost %lld bytes of %s", __func__,
+					(long long)(memoryStart - stored), directory.c_str());
+			addGap(stored, memoryStart);
+			stored = memoryStart;
+		}
+
+		/* The rest stays in memory until a whole block is there */
+		if (written - stored < BUFFER_WRITE_SIZE)
+			return false;
+
+		begin = stored;
+		end = begin + BUFFER_WRITE_SIZE;
+		end = std::min(end, (begin / (int64_t)segmentSize + 1) * (int64_t)segmentSize);
+		end = std::min(end, begin + (int64_t)(memorySize - begin % memorySize));
+	}
+
+	/* The receiver goes on writing into memory meanwhile */
+	size_t index = (begin / segmentSize) % files.size();
+	off_t offset = begin % segmentSize;
+	size_t length = end - begin;
+	bool success = openSegment(index);
+	for (size_t done = 0; success && done < length; ) {
+		ssize_t count = pwrite(files[index], memory + begin % memorySize + done, length - done, offset + done);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0) {
+			libKodi->Log(LOG_ERROR, "%s: cannot write %s: %s", __func__, getSegmentPath(index).c_str(), strerror(errno));
+			success = false;
+			break;
+		}
+		done += count;
+	}
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	/* Kick off the writeback now instead of leaving it to the dirty page
+	 * limits, so the disk sees large sequential writes at a steady pace */
+	if (success)
+		sync_file_range(files[index], offset, length, SYNC_FILE_RANGE_WRITE);
+#endif
+
+	P8PLATFORM::CLockObject lock(mutex);
+	/* Memory that got overwritten while it was written out left garbage
+	 * on the disk */
+	int64_t memoryStart = getMemoryStart();
+	if (!success)
+		addGap(begin, end);
+	else if (memoryStart > begin)
+		addGap(begin, std::min(end, memoryStart));
+	stored = end;
+
+	return true;
+#endif
+}
+
+void StreamBuffer::write(const uint8_t *data, size_t length)
+{
+	if (memorySize == 0)
+		return;
+
+	P8PLATFORM::CLockObject lock(mutex);
+
+	/* More than fits, only the newest part survives anyway */
+	if (length > memorySize) {
+		written += length - memorySize;
+		data += length - memorySize;
+		length = memorySize;
+	}
+
+	while (length > 0) {
+		size_t offset = written % memorySize;
+		size_t count = std::min(length, memorySize - offset);
+		memcpy(memory + offset, data, count);
+		written += count;
+		data += count;
+		length -= count;
+	}
+
+	if (!directory.empty() && written - stored >= BUFFER_WRITE_SIZE)
+		writeEvent.Signal();
+}
+
+void StreamBuffer::copyOut(int64_t position, uint8_t *data, size_t length) const
+{
+	size_t offset = position % memorySize;
+	size_t count = std::min(length, memorySize - offset);
+	memcpy(data, memory + offset, count);
+	memcpy(data + count, memory, length - count);
+}
+
+int64_t StreamBuffer::getReadable(int64_t position)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	position = std::max(position, getStart());
+	if (directory.empty())
+		return position;
+
+	std::map<int64_t, int64_t>::const_iterator it = gaps.upper_bound(position);
+	if (it != gaps.begin())
+		--it;
+	for (; it != gaps.end() && it->first <= position; ++it)
+		position = std::max(position, it->second);
+
+	/* Neither on disk yet nor in memory any more, about to become a gap */
+	if (position >= stored && position < getMemoryStart())
+		position = getMemoryStart();
+
+	return position;
+}
+
+size_t StreamBuffer::read(int64_t position, uint8_t *data, size_t length)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	if (position < getStart() || position >= written)
+		return 0;
+
+	length = std::min((int64_t)length, written - position);
+
+	if (position >= getMemoryStart()) {
+		copyOut(position, data, length);
+		return length;
+	}
+
+#ifdef TARGET_WINDOWS
+	return 0;
+#else
+	/* From disk only what got there and up to the next gap */
+	if (position >= stored || getReadable(position) != position)
+		return 0;
+	std::map<int64_t, int64_t>::const_iterator gap = gaps.upper_bound(position);
+	int64_t end = std::min(stored, (position / (int64_t)segmentSize + 1) * (int64_t)segmentSize);
+	if (gap != gaps.end())
+		end = std::min(end, gap->first);
+	length = std::min((int64_t)length, end - position);
+
+	size_t index = (position / segmentSize) % files.size();
+	int fd = files[index];
+	if (fd < 0)
+		return 0;
+
+	/* Neither the receiver nor the writer thread wait for the disk */
+	lock.Unlock();
+	ssize_t count;
+	do {
+		count = pread(fd, data, length, position % segmentSize);
+	} while (count < 0 && errno == EINTR);
+	lock.Lock();
+
+	if (count <= 0) {
+		libKodi->Log(LOG_ERROR, "%s: cannot read %s: %s", __func__, getSegmentPath(index).c_str(), count < 0 ? strerror(errno) : "end of file");
+		addGap(position, position + length);
+		return 0;
+	}
+
+	/* The writer thread may have reused the space meanwhile */
+	if (position < getStart())
+		return 0;
+
+	return count;
+#endif
+}
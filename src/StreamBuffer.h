@@ -0,0 +1,137 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <p8-platform/threads/mutex.h>
+#include <p8-platform/threads/threads.h>
+
+class StreamBuffer;
+
+/* Moves the data of a ring on disk from memory to the segment files */
+class StreamBufferWriter : public P8PLATFORM::CThread
+{
+	public:
+		explicit StreamBufferWriter(StreamBuffer &buffer) : buffer(buffer) {}
+
+	protected:
+		virtual void *Process(void);
+
+	private:
+		StreamBuffer &buffer;
+};
+
+/*
+ * Bounded ring of TS packets addressed by absolute stream position. The
+ * writer never waits: once the ring is full the oldest data is
+ * overwritten, readers have to check getStart() for what is left.
+ *
+ * Big rings in memory are backed by huge pages where possible and are
+ * faulted in up front, so the receiver does not take page faults while
+ * writing.
+ *
+ * A ring on disk keeps its newest part in memory as well. Writes only go
+ * there, a thread of its own moves the data on to fixed size segment files
+ * in large sequential writes. Data that could not be stored in time is
+ * skipped by readers as a gap in the stream.
+ *
+ * write() and the getters have to be serialized by the owner, read() may
+ * run at the same time as them.
+ */
+class StreamBuffer
+{
+	public:
+		/* In memory */
+		explicit StreamBuffer(size_t size);
+		/* In segment files of directory */
+		StreamBuffer(const std::string &directory, uint64_t size);
+		~StreamBuffer(void);
+
+		uint64_t getSize(void) const { return size; }
+		bool usesHugePages(void) const { return hugePages; }
+		/* Empty for a ring in memory */
+		const std::string& getDirectory(void) const { return directory; }
+		/* Whether a new buffer made for size and directory would be the
+		 * same as this one */
+		bool matches(uint64_t size, const std::string &directory) const;
+
+		/* Oldest and next position to be written */
+		int64_t getStart(void) const { return written > (int64_t)size ? written - (int64_t)size : 0; }
+		int64_t getEnd(void) const { return written; }
+		/* The first position from position on which is still there and
+		 * not part of a gap */
+		int64_t getReadable(int64_t position);
+
+		void write(const uint8_t *data, size_t length);
+		/* Forget the contents, the memory stays */
+		void clear(void);
+		/* Copies out up to length bytes from position, which has to be
+		 * in [getStart(), getEnd()]. Reads from disk may return 0 if
+		 * the data got overwritten or lost meanwhile */
+		size_t read(int64_t position, uint8_t *data, size_t length);
+
+	private:
+		friend class StreamBufferWriter;
+
+		StreamBuffer(const StreamBuffer&);
+		StreamBuffer& operator=(const StreamBuffer&);
+
+		void allocate(void);
+		/* Copies from the memory part, which has to hold the range */
+		void copyOut(int64_t position, uint8_t *data, size_t length) const;
+		int64_t getMemoryStart(void) const { return written > (int64_t)memorySize ? written - (int64_t)memorySize : 0; }
+		/* Run by the writer thread, false if there was nothing to do */
+		bool store(void);
+		bool openSegment(size_t index);
+		std::string getSegmentPath(size_t index) const;
+		void addGap(int64_t begin, int64_t end);
+
+		std::string directory;
+		uint64_t size;
+		/* The whole ring, or the newest part of one on disk */
+		uint8_t *memory;
+		size_t memorySize;
+		/* Length of the memory mapping, 0 for heap memory */
+		size_t mapped;
+		bool hugePages;
+		int64_t written;
+
+		/* Of the segment files, -1 until one is used */
+		std::vector<int> files;
+		size_t segmentSize;
+
+		/* Guards written against read() and what follows against the
+		 * writer thread */
+		P8PLATFORM::CMutex mutex;
+		/* Everything before is on disk or in a gap */
+		int64_t stored;
+		/* Begin and end of the ranges which are not on disk */
+		std::map<int64_t, int64_t> gaps;
+		P8PLATFORM::CEvent writeEvent;
+		StreamBufferWriter writer;
+};
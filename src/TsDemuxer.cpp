@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "TsDemuxer.h"
+#include "TsPidFilter.h"
+#include "client.h"
+
+#ifndef DVD_TIME_BASE
+#define DVD_TIME_BASE 1000000
+#endif
+#ifndef DVD_NOPTS_VALUE
+#define DVD_NOPTS_VALUE 0xFFF0000000000000
+#endif
+
+#define PES_HEADER_SIZE 9
+
+TsDemuxer::TsDemuxer(bool followPsi)
+	: streamIndex(TS_PID_COUNT, -1), program(-1), version(-1), pcrPid(TS_PID_NULL), followPsi(followPsi), pmtPid(-1)
+{
+}
+
+void TsDemuxer::setClock(const TsClock &clock)
+{
+	this->clock = clock;
+}
+
+void TsDemuxer::setTime(int64_t time)
+{
+	clock.restart(time);
+}
+
+TsDemuxer::~TsDemuxer(void)
+{
+	flush();
+}
+
+void TsDemuxer::setProgramMap(const TsProgramMap &map)
+{
+	if (map.program == program && map.version == version)
+		return;
+
+	flush();
+
+	streams.clear();
+	streamIndex.assign(TS_PID_COUNT, -1);
+	for (std::vector<TsElementaryStream>::const_iterator it = map.streams.begin(); it != map.streams.end(); ++it) {
+		if (it->codec == NULL)
+			continue;
+
+		Stream stream;
+		stream.pid = it->pid;
+		stream.started = false;
+		stream.continuity = -1;
+		streamIndex[it->pid] = streams.size();
+		streams.push_back(stream);
+	}
+
+	programMap = map;
+	program = map.program;
+	version = map.version;
+	pcrPid = map.pcrPid;
+
+	/* Makes Kodi ask for the stream properties again */
+	DemuxPacket *change = pvr->AllocateDemuxPacket(0);
+	if (change != NULL) {
+		change->iStreamId = DMX_SPECIALID_STREAMCHANGE;
+		queue.push_back(change);
+	}
+}
+
+bool TsDemuxer::getProgramMap(TsProgramMap &map) const
+{
+	if (version < 0)
+		return false;
+
+	map = programMap;
+	return true;
+}
+
+void TsDemuxer::parsePsi(const uint8_t *packet, int pid)
+{
+	if (pid == TS_PID_PAT) {
+		std::map<int, int> programs;
+		if (!patAssembler.push(packet) || !tsParsePat(patAssembler.getSection(), programs))
+			return;
+
+		pmtPids.clear();
+		for (std::map<int, int>::const_iterator it = programs.begin(); it != programs.end(); ++it)
+			pmtPids.push_back(it->second);
+		return;
+	}
+
+	pmtPid = pid;
+
+	TsProgramMap map;
+	if (pmtAssembler.push(packet) && tsParsePmt(pmtAssembler.getSection(), map))
+		setProgramMap(map);
+}
+
+void TsDemuxer::push(const uint8_t *packets, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		pushPacket(packets + i * TS_PACKET_SIZE);
+}
+
+DemuxPacket *TsDemuxer::pop(void)
+{
+	if (queue.empty())
+		return NULL;
+
+	DemuxPacket *packet = queue.front();
+	queue.pop_front();
+	return packet;
+}
+
+void TsDemuxer::flush(void)
+{
+	for (std::deque<DemuxPacket*>::iterator it = queue.begin(); it != queue.end(); ++it)
+		pvr->FreeDemuxPacket(*it);
+	queue.clear();
+
+	for (std::vector<Stream>::iterator it = streams.begin(); it != streams.end(); ++it) {
+		it->pes.clear();
+		it->started = false;
+		it->continuity = -1;
+	}
+}
+
+void TsDemuxer::reset(void)
+{
+	flush();
+	clock.reset();
+}
+
+void TsDemuxer::pushPacket(const uint8_t *packet)
+{
+	/* Transport error indicator, nothing in there is trustworthy */
+	if (packet[0] != TS_SYNC_BYTE || (packet[1] & 0x80))
+		return;
+
+	int pid = ((packet[1] & 0x1f) << 8) | packet[2];
+	if (followPsi && (pid == TS_PID_PAT || pid == pmtPid ||
+			(pmtPid < 0 && std::find(pmtPids.begin(), pmtPids.end(), pid) != pmtPids.end()))) {
+		parsePsi(packet, pid);
+		return;
+	}
+
+	int index = streamIndex[pid];
+	if (index < 0 && pid != pcrPid)
+		return;
+
+	size_t offset = 4;
+	if (packet[3] & 0x20) {
+		int64_t pcr = pid == pcrPid ? tsPcr(packet) : -1;
+
+		/* Jumps are folded out like the time index does */
+		if (pcr >= 0)
+			clock.addPcr(pcr, (packet[5] & 0x80) != 0);
+		offset += 1 + packet[4];
+	}
+
+	if (index < 0 || !(packet[3] & 0x10) || offset >= TS_PACKET_SIZE)
+		return;
+
+	Stream &stream = streams[index];
+
+	int continuity = packet[3] & 0x0f;
+	if (continuity == stream.continuity)
+		return;
+	if (stream.continuity >= 0 && continuity != ((stream.continuity + 1) & 0x0f)) {
+		/* Lost a packet, the PES being assembled is broken */
+		stream.pes.clear();
+		stream.started = false;
+	}
+	stream.continuity = continuity;
+
+	if (packet[1] & 0x40) {
+		if (stream.started)
+			finishPes(stream);
+		stream.started = true;
+	}
+	if (!stream.started)
+		return;
+
+	stream.pes.insert(stream.pes.end(), packet + offset, packet + TS_PACKET_SIZE);
+
+	/* Hand out PES of known length right away instead of waiting for
+	 * the next one to start */
+	if (stream.pes.size() >= 6) {
+		size_t length = (stream.pes[4] << 8) | stream.pes[5];
+		if (length > 0 && stream.pes.size() >= length + 6)
+			finishPes(stream);
+	}
+}
+
+void TsDemuxer::finishPes(Stream &stream)
+{
+	const std::vector<uint8_t> &pes = stream.pes;
+	stream.started = false;
+
+	if (pes.size() < PES_HEADER_SIZE || pes[0] != 0 || pes[1] != 0 || pes[2] != 1) {
+		stream.pes.clear();
+		return;
+	}
+
+	size_t length = (pes[4] << 8) | pes[5];
+	size_t end = length > 0 ? std::min(pes.size(), length + 6) : pes.size();
+	size_t payload = PES_HEADER_SIZE + pes[8];
+	if (payload >= end) {
+		stream.pes.clear();
+		return;
+	}
+
+	double pts = DVD_NOPTS_VALUE;
+	double dts = DVD_NOPTS_VALUE;
+	int flags = pes[7] >> 6;
+	if ((flags & 0x02) && payload >= PES_HEADER_SIZE + 5) {
+		pts = toTime(((int64_t)(pes[9] & 0x0e) << 29) | (pes[10] << 22) | ((pes[11] & 0xfe) << 14) | (pes[12] << 7) | (pes[13] >> 1));
+		dts = pts;
+	}
+	if (flags == 0x03 && payload >= PES_HEADER_SIZE + 10)
+		dts = toTime(((int64_t)(pes[14] & 0x0e) << 29) | (pes[15] << 22) | ((pes[16] & 0xfe) << 14) | (pes[17] << 7) | (pes[18] >> 1));
+
+	DemuxPacket *packet = pvr->AllocateDemuxPacket(end - payload);
+	if (packet != NULL) {
+		memcpy(packet->pData, &pes[payload], end - payload);
+		packet->iSize = end - payload;
+		packet->iStreamId = stream.pid;
+		packet->pts = pts;
+		packet->dts = dts;
+		queue.push_back(packet);
+	}
+
+	stream.pes.clear();
+}
+
+double TsDemuxer::toTime(int64_t timestamp) const
+{
+	int64_t time;
+	if (!clock.toTime(timestamp, time))
+		return DVD_NOPTS_VALUE;
+
+	return (double)time * DVD_TIME_BASE / TS_CLOCK_RATE;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <xbmc_pvr_types.h>
+
+#include "TsPsi.h"
+#include "TsTimeIndex.h"
+
+/*
+ * Turns the TS packets of one service into the PES payloads Kodi's PVR
+ * demuxer expects. The streams are taken from the PMT, packets are tagged
+ * with their PID, which is also the stream id reported through
+ * GetStreamProperties.
+ */
+class TsDemuxer
+{
+	public:
+		/* With followPsi the service is found through the PAT and PMT
+		 * in the stream, e.g. of a recording, instead of being set */
+		explicit TsDemuxer(bool followPsi = false);
+		~TsDemuxer(void);
+
+		/* A different program or PMT version queues a stream change */
+		void setProgramMap(const TsProgramMap &map);
+		/* False if no PMT was seen yet */
+		bool getProgramMap(TsProgramMap &map) const;
+		/* Continue with the clock of a time index, so packet times
+		 * match its stream times. Otherwise time 0 is the first PCR */
+		void setClock(const TsClock &clock);
+		/* The next PCR gets stream time time in 90 kHz ticks, e.g.
+		 * after a seek by position */
+		void setTime(int64_t time);
+		void push(const uint8_t *packets, size_t count);
+		/* Next complete packet, NULL if there is none */
+		DemuxPacket *pop(void);
+
+		/* Drop everything queued or being assembled */
+		void flush(void);
+		/* Like flush, but also forget the clock */
+		void reset(void);
+
+	private:
+		struct Stream
+		{
+			int pid;
+			std::vector<uint8_t> pes;
+			bool started;
+			int continuity;
+		};
+
+		void pushPacket(const uint8_t *packet);
+		void parsePsi(const uint8_t *packet, int pid);
+		void finishPes(Stream &stream);
+		double toTime(int64_t timestamp) const;
+
+		std::vector<Stream> streams;
+		/* PID to index into streams, -1 for PIDs not demuxed */
+		std::vector<int> streamIndex;
+		std::deque<DemuxPacket*> queue;
+
+		TsProgramMap programMap;
+		int program;
+		int version;
+		int pcrPid;
+
+		bool followPsi;
+		TsSectionAssembler patAssembler;
+		TsSectionAssembler pmtAssembler;
+		/* Of all services of the transponder as listed by the PAT, the
+		 * first one that shows up is the one that was recorded */
+		std::vector<int> pmtPids;
+		int pmtPid;
+		/* Timestamps are unknown until it runs */
+		TsClock clock;
+};
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <cstring>
+
+#include "TsPidFilter.h"
+
+TsPidFilter::TsPidFilter(void)
+{
+	std::vector<int> all;
+	set(all);
+}
+
+void TsPidFilter::set(const std::vector<int> &pids)
+{
+	memset(mask, pids.empty() ? 1 : 0, sizeof(mask));
+	for (std::vector<int>::const_iterator it = pids.begin(); it != pids.end(); ++it)
+		add(*it);
+	mask[TS_PID_NULL] = 0;
+}
+
+void TsPidFilter::add(int pid)
+{
+	if (pid >= 0 && pid < TS_PID_COUNT && pid != TS_PID_NULL)
+		mask[pid] = 1;
+}
+
+void TsPidFilter::remove(int pid)
+{
+	if (pid >= 0 && pid < TS_PID_COUNT)
+		mask[pid] = 0;
+}
+
+size_t TsPidFilter::filter(const uint8_t *packets, size_t count, uint8_t *out) const
+{
+	size_t copied = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		const uint8_t *p = packets + i * TS_PACKET_SIZE;
+		if (p[0] == TS_SYNC_BYTE && mask[((p[1] & 0x1f) << 8) | p[2]])
+			memcpy(out + copied++ * TS_PACKET_SIZE, p, TS_PACKET_SIZE);
+	}
+
+	return copied;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+#define TS_PID_COUNT 8192
+#define TS_PID_NULL 0x1fff
+
+/*
+ * Selects the TS packets of a set of PIDs out of a run of packets. Packets
+ * without sync byte and null packets never pass.
+ */
+class TsPidFilter
+{
+	public:
+		/* Accepts all PIDs until set() is called */
+		TsPidFilter(void);
+
+		/* An empty list accepts all PIDs */
+		void set(const std::vector<int> &pids);
+		void add(int pid);
+		void remove(int pid);
+		bool accepts(int pid) const { return mask[pid] != 0; }
+
+		/* Copies the accepted packets of count packets to out, which
+		 * needs room for all of them. Returns the number copied. */
+		size_t filter(const uint8_t *packets, size_t count, uint8_t *out) const;
+
+	private:
+		uint8_t mask[TS_PID_COUNT];
+};
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include "TsPsi.h"
+#include "TsPidFilter.h"
+
+#define PSI_MAX_SECTION 1024
+#define PSI_HEADER_SIZE 3
+#define PSI_CRC_SIZE 4
+
+#define TABLE_PAT 0x00
+#define TABLE_PMT 0x02
+
+#define DESCRIPTOR_ISO639 0x0a
+#define DESCRIPTOR_TELETEXT 0x56
+#define DESCRIPTOR_SUBTITLING 0x59
+#define DESCRIPTOR_AC3 0x6a
+#define DESCRIPTOR_EAC3 0x7a
+#define DESCRIPTOR_DTS 0x7b
+#define DESCRIPTOR_AAC 0x7c
+
+TsSectionAssembler::TsSectionAssembler(void)
+{
+	reset();
+}
+
+void TsSectionAssembler::reset(void)
+{
+	section.clear();
+	length = 0;
+	continuity = -1;
+}
+
+bool TsSectionAssembler::push(const uint8_t *packet)
+{
+	bool start = (packet[1] & 0x40) != 0;
+	int cc = packet[3] & 0x0f;
+	size_t offset = 4;
+
+	/* Skip the adaptation field, packets without payload carry nothing */
+	if (packet[3] & 0x20)
+		offset += 1 + packet[4];
+	if (!(packet[3] & 0x10) || offset >= TS_PACKET_SIZE)
+		return false;
+
+	if (start) {
+		offset += 1 + packet[offset];
+		if (offset >= TS_PACKET_SIZE)
+			return false;
+
+		section.clear();
+		length = 0;
+	} else if (section.empty() || continuity < 0 || cc != ((continuity + 1) & 0x0f)) {
+		/* Lost the start or a packet in between */
+		section.clear();
+		continuity = cc;
+		return false;
+	}
+	continuity = cc;
+
+	section.insert(section.end(), packet + offset, packet + TS_PACKET_SIZE);
+
+	if (length == 0 && section.size() >= PSI_HEADER_SIZE) {
+		length = PSI_HEADER_SIZE + (((section[1] & 0x0f) << 8) | section[2]);
+		if (length > PSI_MAX_SECTION || length < PSI_HEADER_SIZE + PSI_CRC_SIZE) {
+			section.clear();
+			return false;
+		}
+	}
+
+	if (length == 0 || section.size() < length)
+		return false;
+
+	section.resize(length);
+	bool valid = tsCrc32(&section[0], length) == 0;
+	if (!valid)
+		section.clear();
+
+	return valid;
+}
+
+struct CrcTable
+{
+	uint32_t entries[256];
+
+	CrcTable(void)
+	{
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i << 24;
+			for (int j = 0; j < 8; j++)
+				crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+			entries[i] = crc;
+		}
+	}
+};
+
+static const CrcTable crcTable;
+
+uint32_t tsCrc32(const uint8_t *data, size_t length)
+{
+	/* Over a whole section including its CRC this yields 0 */
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < length; i++)
+		crc = (crc << 8) ^ crcTable.entries[((crc >> 24) ^ data[i]) & 0xff];
+
+	return crc;
+}
+
+bool tsParsePat(const std::vector<uint8_t> &section, std::map<int, int> &programs)
+{
+	if (section.size() < 8 + PSI_CRC_SIZE || section[0] != TABLE_PAT)
+		return false;
+
+	programs.clear();
+	for (size_t i = 8; i + 4 <= section.size() - PSI_CRC_SIZE; i += 4) {
+		int program = (section[i] << 8) | section[i + 1];
+		int pid = ((section[i + 2] & 0x1f) << 8) | section[i + 3];
+
+		/* Program 0 points to the network information */
+		if (program != 0)
+			programs[program] = pid;
+	}
+
+	return true;
+}
+
+static void parseDescriptors(const uint8_t *data, size_t length, TsElementaryStream &stream)
+{
+	for (size_t i = 0; i + 2 <= length; ) {
+		int tag = data[i];
+		size_t len = data[i + 1];
+		const uint8_t *d = data + i + 2;
+		if (i + 2 + len > length)
+			break;
+
+		switch (tag) {
+		case DESCRIPTOR_ISO639:
+			if (len >= 3)
+				stream.language.assign((const char *)d, 3);
+			break;
+		case DESCRIPTOR_AC3:
+			if (stream.type == 0x06) {
+				stream.kind = TS_STREAM_AUDIO;
+				stream.codec = "ac3";
+			}
+			break;
+		case DESCRIPTOR_EAC3:
+			if (stream.type == 0x06) {
+				stream.kind = TS_STREAM_AUDIO;
+				stream.codec = "eac3";
+			}
+			break;
+		case DESCRIPTOR_DTS:
+			if (stream.type == 0x06) {
+				stream.kind = TS_STREAM_AUDIO;
+				stream.codec = "dts";
+			}
+			break;
+		case DESCRIPTOR_AAC:
+			if (stream.type == 0x06) {
+				stream.kind = TS_STREAM_AUDIO;
+				stream.codec = "aac";
+			}
+			break;
+		case DESCRIPTOR_SUBTITLING:
+			stream.kind = TS_STREAM_SUBTITLE;
+			stream.codec = "dvbsub";
+			if (len >= 8) {
+				stream.language.assign((const char *)d, 3);
+				stream.compositionPage = (d[4] << 8) | d[5];
+				stream.ancillaryPage = (d[6] << 8) | d[7];
+			}
+			break;
+		case DESCRIPTOR_TELETEXT:
+			stream.kind = TS_STREAM_TELETEXT;
+			stream.codec = "teletext";
+			if (len >= 3)
+				stream.language.assign((const char *)d, 3);
+			break;
+		}
+
+		i += 2 + len;
+	}
+}
+
+bool tsParsePmt(const std::vector<uint8_t> &section, TsProgramMap &pmt)
+{
+	if (section.size() < 12 + PSI_CRC_SIZE || section[0] != TABLE_PMT)
+		return false;
+
+	pmt.program = (section[3] << 8) | section[4];
+	pmt.version = (section[5] >> 1) & 0x1f;
+	pmt.pcrPid = ((section[8] & 0x1f) << 8) | section[9];
+	pmt.streams.clear();
+
+	size_t end = section.size() - PSI_CRC_SIZE;
+	size_t i = 12 + (((section[10] & 0x0f) << 8) | section[11]);
+	while (i + 5 <= end) {
+		TsElementaryStream stream;
+		stream.type = section[i];
+		stream.pid = ((section[i + 1] & 0x1f) << 8) | section[i + 2];
+		stream.kind = TS_STREAM_OTHER;
+		stream.codec = NULL;
+		stream.compositionPage = 0;
+		stream.ancillaryPage = 0;
+		size_t infoLength = ((section[i + 3] & 0x0f) << 8) | section[i + 4];
+		if (i + 5 + infoLength > end)
+			return false;
+
+		switch (stream.type) {
+		case 0x01:
+		case 0x02:
+			stream.kind = TS_STREAM_VIDEO;
+			stream.codec = "mpeg2video";
+			break;
+		case 0x1b:
+			stream.kind = TS_STREAM_VIDEO;
+			stream.codec = "h264";
+			break;
+		case 0x24:
+			stream.kind = TS_STREAM_VIDEO;
+			stream.codec = "hevc";
+			break;
+		case 0x03:
+		case 0x04:
+			stream.kind = TS_STREAM_AUDIO;
+			stream.codec = "mp2";
+			break;
+		case 0x0f:
+			stream.kind = TS_STREAM_AUDIO;
+			stream.codec = "aac";
+			break;
+		case 0x11:
+			stream.kind = TS_STREAM_AUDIO;
+			stream.codec = "aac_latm";
+			break;
+		case 0x81:
+			stream.kind = TS_STREAM_AUDIO;
+			stream.codec = "ac3";
+			break;
+		case 0x87:
+			stream.kind = TS_STREAM_AUDIO;
+			stream.codec = "eac3";
+			break;
+		}
+
+		parseDescriptors(&section[i + 5], infoLength, stream);
+		pmt.streams.push_back(stream);
+
+		i += 5 + infoLength;
+	}
+
+	return true;
+}
+
+int64_t tsPcr(const uint8_t *packet)
+{
+	if (!(packet[3] & 0x20) || packet[4] < 7 || !(packet[5] & 0x10))
+		return -1;
+
+	return ((int64_t)packet[6] << 25) | (packet[7] << 17) | (packet[8] << 9) | (packet[9] << 1) | (packet[10] >> 7);
+}
+
+int64_t tsPesPts(const uint8_t *packet)
+{
+	if (!(packet[1] & 0x40) || !(packet[3] & 0x10))
+		return -1;
+
+	size_t offset = 4;
+	if (packet[3] & 0x20)
+		offset += 1 + packet[4];
+	if (offset + 14 > TS_PACKET_SIZE)
+		return -1;
+
+	const uint8_t *pes = packet + offset;
+	if (pes[0] != 0 || pes[1] != 0 || pes[2] != 1 || !(pes[7] & 0x80))
+		return -1;
+
+	return ((int64_t)(pes[9] & 0x0e) << 29) | (pes[10] << 22) | ((pes[11] & 0xfe) << 14) | (pes[12] << 7) | (pes[13] >> 1);
+}
+
+int64_t tsUnwrapTimestamp(int64_t timestamp, int64_t reference)
+{
+	if (reference < 0)
+		return timestamp;
+
+	timestamp += reference - reference % TS_TIMESTAMP_WRAP;
+	if (timestamp - reference > TS_TIMESTAMP_WRAP / 2)
+		timestamp -= TS_TIMESTAMP_WRAP;
+	else if (reference - timestamp > TS_TIMESTAMP_WRAP / 2)
+		timestamp += TS_TIMESTAMP_WRAP;
+
+	return timestamp;
+}
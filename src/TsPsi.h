@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define TS_PID_PAT 0x0000
+/* PIDs below this carry tables of the transport stream itself */
+#define TS_PID_SI_END 0x0020
+/* PCR base and PTS are 33 bit counters of a 90 kHz clock */
+#define TS_TIMESTAMP_WRAP (1LL << 33)
+#define TS_CLOCK_RATE 90000
+
+enum TsStreamKind
+{
+	TS_STREAM_OTHER,
+	TS_STREAM_VIDEO,
+	TS_STREAM_AUDIO,
+	TS_STREAM_SUBTITLE,
+	TS_STREAM_TELETEXT
+};
+
+struct TsElementaryStream
+{
+	int pid;
+	int type;
+	TsStreamKind kind;
+	/* ffmpeg codec name, NULL if not decodable */
+	const char *codec;
+	std::string language;
+	/* From the subtitling descriptor, for DVB subtitles */
+	int compositionPage;
+	int ancillaryPage;
+};
+
+struct TsProgramMap
+{
+	int program;
+	int version;
+	int pcrPid;
+	std::vector<TsElementaryStream> streams;
+};
+
+/*
+ * Reassembles the PSI sections of one PID from its TS packets. Only the
+ * first section starting in a packet is picked up, which is all PAT and
+ * PMT need.
+ */
+class TsSectionAssembler
+{
+	public:
+		TsSectionAssembler(void);
+
+		/* Returns true once a complete section with a valid CRC is
+		 * available through getSection() */
+		bool push(const uint8_t *packet);
+		const std::vector<uint8_t>& getSection(void) const { return section; }
+
+		void reset(void);
+
+	private:
+		std::vector<uint8_t> section;
+		size_t length;
+		int continuity;
+};
+
+uint32_t tsCrc32(const uint8_t *data, size_t length);
+/* Program number to PMT PID */
+bool tsParsePat(const std::vector<uint8_t> &section, std::map<int, int> &programs);
+bool tsParsePmt(const std::vector<uint8_t> &section, TsProgramMap &pmt);
+
+/* PCR base of a TS packet, -1 if it carries none */
+int64_t tsPcr(const uint8_t *packet);
+/* PTS of the PES starting in a TS packet, -1 if none starts or it has
+ * no PTS */
+int64_t tsPesPts(const uint8_t *packet);
+/* Extends a 33 bit timestamp into the wrap period closest to reference,
+ * which is an already extended timestamp or negative if there is none */
+int64_t tsUnwrapTimestamp(int64_t timestamp, int64_t reference);
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <algorithm>
+
+#include "TsTimeIndex.h"
+#include "TsPsi.h"
+
+/* One entry per 100 ms of stream */
+#define TIME_INDEX_INTERVAL (TS_CLOCK_RATE / 10)
+/* PCRs are at most 100 ms apart, anything beyond this is a clock jump.
+ * PTS are no further off the PCR than that either */
+#define TIME_INDEX_MAX_GAP (10 * TS_CLOCK_RATE)
+
+static bool entryBefore(const TsTimeIndex::Entry &entry, int64_t time)
+{
+	return entry.time < time;
+}
+
+static bool positionBefore(int64_t position, const TsTimeIndex::Entry &entry)
+{
+	return position < entry.position;
+}
+
+void TsClock::reset(void)
+{
+	lastPcr = -1;
+	lastTime = 0;
+	offset = 0;
+	startTime = 0;
+}
+
+void TsClock::restart(int64_t time)
+{
+	reset();
+	startTime = time;
+}
+
+void TsClock::resume(int64_t time, int64_t offset)
+{
+	this->offset = offset;
+	lastTime = time;
+	lastPcr = time - offset;
+}
+
+int64_t TsClock::addPcr(int64_t pcr, bool discontinuity)
+{
+	if (lastPcr < 0)
+		offset = startTime - pcr;
+
+	int64_t extended = tsUnwrapTimestamp(pcr, lastPcr);
+	int64_t time = extended + offset;
+
+	/* Carry on where the old clock stopped */
+	if (lastPcr >= 0 && (discontinuity || time < lastTime || time > lastTime + TIME_INDEX_MAX_GAP)) {
+		extended = pcr;
+		offset = lastTime - pcr;
+		time = lastTime;
+	}
+
+	lastPcr = extended;
+	lastTime = time;
+	return time;
+}
+
+bool TsClock::toTime(int64_t timestamp, int64_t &time) const
+{
+	if (lastPcr < 0)
+		return false;
+
+	time = tsUnwrapTimestamp(timestamp, lastPcr) + offset;
+	return time >= lastTime - TIME_INDEX_MAX_GAP && time <= lastTime + TIME_INDEX_MAX_GAP;
+}
+
+TsTimeIndex::TsTimeIndex(void)
+{
+	clear();
+}
+
+void TsTimeIndex::clear(void)
+{
+	entries.clear();
+	keyframes.clear();
+	startTime = 0;
+	clock.reset();
+}
+
+void TsTimeIndex::add(int64_t pcr, bool discontinuity, int64_t position)
+{
+	if (!clock.isRunning())
+		startTime = time(NULL);
+
+	int64_t offset = clock.getOffset();
+	int64_t time = clock.addPcr(pcr, discontinuity);
+
+	/* Every clock jump gets an entry, so the clock can be picked up
+	 * anywhere from the entries */
+	if (entries.empty() || time >= entries.back().time + TIME_INDEX_INTERVAL || clock.getOffset() != offset) {
+		Entry entry = { time, position, clock.getOffset() };
+		entries.push_back(entry);
+	}
+}
+
+void TsTimeIndex::addKeyframe(int64_t pts, int64_t position)
+{
+	int64_t time;
+	if (!clock.toTime(pts, time))
+		return;
+
+	/* Audio frames are all keyframes, they get thinned out like PCRs */
+	if (keyframes.empty() || time >= keyframes.back().time + TIME_INDEX_INTERVAL) {
+		Entry entry = { time, position, clock.getOffset() };
+		keyframes.push_back(entry);
+	}
+}
+
+void TsTimeIndex::trim(int64_t position)
+{
+	while (!entries.empty() && entries.front().position < position)
+		entries.pop_front();
+	while (!keyframes.empty() && keyframes.front().position < position)
+		keyframes.pop_front();
+}
+
+bool TsTimeIndex::find(int64_t time, bool backwards, Entry &entry) const
+{
+	const std::deque<Entry> &list = keyframes.empty() ? entries : keyframes;
+	if (list.empty())
+		return false;
+
+	/* First one at or after time */
+	std::deque<Entry>::const_iterator it = std::lower_bound(list.begin(), list.end(), time, entryBefore);
+	if (it == list.end() || (backwards && it->time > time && it != list.begin()))
+		--it;
+
+	entry = *it;
+	return true;
+}
+
+bool TsTimeIndex::getClock(int64_t position, TsClock &clock) const
+{
+	if (entries.empty())
+		return false;
+
+	/* Last one at or before position, or the first one */
+	std::deque<Entry>::const_iterator it = std::upper_bound(entries.begin(), entries.end(), position, positionBefore);
+	if (it != entries.begin())
+		--it;
+
+	clock.resume(it->time, it->offset);
+	return true;
+}
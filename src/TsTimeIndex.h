@@ -0,0 +1,112 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <deque>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Stream time of a service, following its PCRs. Stream time counts 90 kHz
+ * ticks since the first PCR and keeps increasing across wraps and clock
+ * jumps: after a jump or an announced discontinuity it carries on where
+ * the old clock stopped.
+ */
+class TsClock
+{
+	public:
+		TsClock(void) { reset(); }
+
+		void reset(void);
+		/* Like reset, but the next PCR gets stream time time */
+		void restart(int64_t time);
+		/* Carries on from a point of a time index */
+		void resume(int64_t time, int64_t offset);
+		/* Stream time of the 33 bit PCR base */
+		int64_t addPcr(int64_t pcr, bool discontinuity);
+		/* Stream time of a PTS or DTS, false before the first PCR or
+		 * if it is too far off the PCR */
+		bool toTime(int64_t timestamp, int64_t &time) const;
+
+		bool isRunning(void) const { return lastPcr >= 0; }
+		/* Stream time minus extended PCR, changes with clock jumps */
+		int64_t getOffset(void) const { return offset; }
+
+	private:
+		/* Last extended PCR and its stream time */
+		int64_t lastPcr;
+		int64_t lastTime;
+		int64_t offset;
+		/* Stream time of the first PCR */
+		int64_t startTime;
+};
+
+/*
+ * Sparse map from stream time to stream position, fed with the PCRs of a
+ * service as they pass by, so the stream can be searched by time.
+ *
+ * Keyframes are kept apart with the time of their PTS, a seek should land
+ * on one of them rather than somewhere in a GOP.
+ */
+class TsTimeIndex
+{
+	public:
+		struct Entry
+		{
+			int64_t time;
+			int64_t position;
+			/* Of the clock at that point */
+			int64_t offset;
+		};
+
+		TsTimeIndex(void);
+
+		/* pcr is the 33 bit base as found in the packet at position */
+		void add(int64_t pcr, bool discontinuity, int64_t position);
+		/* A random access point, ignored before the first PCR */
+		void addKeyframe(int64_t pts, int64_t position);
+		/* Forget the entries before position */
+		void trim(int64_t position);
+		void clear(void);
+
+		bool isEmpty(void) const { return entries.empty(); }
+		const Entry& front(void) const { return entries.front(); }
+		const Entry& back(void) const { return entries.back(); }
+		/* Keyframe at or before time, or at or after it if not
+		 * backwards, the closest one if there is none in that direction.
+		 * Falls back to the PCRs without keyframes. False if the index
+		 * is empty */
+		bool find(int64_t time, bool backwards, Entry &entry) const;
+		/* The clock as it was at position, give or take one entry.
+		 * False if the index is empty */
+		bool getClock(int64_t position, TsClock &clock) const;
+
+		/* Wall clock time of stream time 0 */
+		time_t getStartTime(void) const { return startTime; }
+
+	private:
+		std::deque<Entry> entries;
+		std::deque<Entry> keyframes;
+		time_t startTime;
+		TsClock clock;
+};
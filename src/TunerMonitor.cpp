@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include "TunerMonitor.h"
+#include "WorkerPool.h"
+#include "rtsp_client.hpp"
+#include "client.h"
+
+using namespace ADDON;
+
+/* Seconds between two DESCRIBE requests to a server */
+#define TUNER_POLL_INTERVAL 15
+/* Weight of the latest RTCP report in the frontend averages */
+#define TUNER_SAMPLE_WEIGHT 0.1
+/* Score of a frontend that never reported anything */
+#define TUNER_UNKNOWN_SCORE 0.5
+/* Frontends scoring closer than this are considered equal */
+#define TUNER_SCORE_TOLERANCE 0.05
+/* Seconds a frontend is passed over after it refused a delivery system.
+ * A refusal may just as well be a busy tuner or a network hiccup */
+#define TUNER_REFUSED_TIMEOUT 600
+
+double TunerMonitor::Frontend::getScore(void) const
+{
+	if (samples == 0)
+		return TUNER_UNKNOWN_SCORE;
+
+	return (level + quality) / 2;
+}
+
+TunerMonitor::TunerMonitor(void)
+{
+	nextPoll = 0;
+}
+
+void TunerMonitor::setServers(const std::vector<std::string> &addresses)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State> old;
+	old.swap(servers);
+
+	for (std::vector<std::string>::const_iterator it = addresses.begin(); it != addresses.end(); ++it) {
+		std::map<std::string, State>::const_iterator known = old.find(*it);
+		if (known != old.end()) {
+			servers[*it] = known->second;
+			continue;
+		}
+
+		State &state = servers[*it];
+		state.frontends = -1;
+		state.streams = 0;
+		state.local = 0;
+		state.reachable = false;
+		state.updated = 0;
+		state.polls = 0;
+		state.failures = 0;
+	}
+
+	nextPoll = 0;
+}
+
+void TunerMonitor::store(const std::string &address, bool ok, const rtsp_server_status &status, time_t now)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State>::iterator it = servers.find(address);
+	if (it == servers.end())
+		return;
+
+	State &state = it->second;
+	state.polls++;
+	state.reachable = ok;
+	if (!ok) {
+		state.failures++;
+		return;
+	}
+
+	state.frontends = status.frontends;
+	state.streams = status.streams;
+	state.local = 0;
+	state.updated = now;
+	state.tuned.clear();
+	for (std::vector<std::pair<int, int> >::const_iterator t = status.tuned.begin(); t != status.tuned.end(); ++t)
+		state.tuned.insert(*t);
+}
+
+void TunerMonitor::poll(time_t now)
+{
+	std::vector<std::string> addresses;
+	std::vector<rtsp_server_status> status;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		for (std::map<std::string, State>::const_iterator it = servers.begin(); it != servers.end(); ++it) {
+			addresses.push_back(it->first);
+			status.push_back(rtsp_server_status());
+			status.back().frontends = it->second.frontends;
+		}
+	}
+	nextPoll = now + TUNER_POLL_INTERVAL;
+
+	std::vector<char> ok(addresses.size());
+	WorkerPool::run(addresses.size(), addresses.size(), [&](size_t i) {
+		ok[i] = rtsp_describe("rtsp://" + addresses[i] + "/", status[i]);
+	});
+
+	for (size_t i = 0; i < addresses.size(); i++)
+		store(addresses[i], ok[i], status[i], now);
+}
+
+void TunerMonitor::refresh(const std::string &address)
+{
+	rtsp_server_status status;
+	{
+		P8PLATFORM::CLockObject lock(mutex);
+		std::map<std::string, State>::const_iterator it = servers.find(address);
+		if (it == servers.end())
+			return;
+		status.frontends = it->second.frontends;
+	}
+
+	bool ok = rtsp_describe("rtsp://" + address + "/", status);
+	store(address, ok, status, time(NULL));
+}
+
+int TunerMonitor::getFree(const std::string &address) const
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State>::const_iterator it = servers.find(address);
+	if (it == servers.end() || !it->second.reachable || it->second.frontends < 0)
+		return -1;
+
+	const State &state = it->second;
+	int busy = state.streams + state.local;
+	return busy < state.frontends ? state.frontends - busy : 0;
+}
+
+int TunerMonitor::pickFrontend(const std::string &address, const std::string &system, int frequency) const
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State>::const_iterator it = servers.find(address);
+	if (it == servers.end() || !it->second.reachable || it->second.frontends <= 0)
+		return 0;
+
+	const State &state = it->second;
+
+	/* A frontend already on the transponder serves the stream for free,
+	 * leave that to the server */
+	for (std::multimap<int, int>::const_iterator t = state.tuned.begin(); t != state.tuned.end(); ++t) {
+		if (t->second == frequency)
+			return 0;
+	}
+
+	/* Otherwise the idle frontend which received best so far, ties go
+	 * to the one used least to spread the load */
+	time_t now = time(NULL);
+	int best = 0;
+	double bestScore = 0;
+	size_t bestSessions = 0;
+	for (int fe = 1; fe <= state.frontends; fe++) {
+		if (state.tuned.count(fe) > 0)
+			continue;
+
+		Frontend unknown;
+		std::map<int, Frontend>::const_iterator f = state.frontendStats.find(fe);
+		const Frontend &stats = f != state.frontendStats.end() ? f->second : unknown;
+		std::map<std::string, time_t>::const_iterator refused = stats.refused.find(system);
+		if (refused != stats.refused.end() && refused->second > now)
+			continue;
+
+		double score = stats.getScore();
+		if (best == 0 || score > bestScore + TUNER_SCORE_TOLERANCE ||
+				(score > bestScore - TUNER_SCORE_TOLERANCE && stats.sessions < bestSessions)) {
+			best = fe;
+			bestScore = score;
+			bestSessions = stats.sessions;
+		}
+	}
+
+	return best;
+}
+
+void TunerMonitor::frontendFailed(const std::string &address, int frontend, const std::string &system)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State>::iterator it = servers.find(address);
+	if (it == servers.end())
+		return;
+
+	Frontend &stats = it->second.frontendStats[frontend];
+	stats.failures++;
+	stats.refused[system] = time(NULL) + TUNER_REFUSED_TIMEOUT;
+
+	libKodi->Log(LOG_INFO, "%s: frontend %d of %s refused %s", __func__, frontend, address.c_str(), system.c_str());
+}
+
+void TunerMonitor::sample(const std::string &address, int frontend, int level, int quality)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State>::iterator it = servers.find(address);
+	if (it == servers.end())
+		return;
+
+	/* SES1 reports the level in [0, 255] and the quality in [0, 15] */
+	double l = level / 255.0;
+	double q = quality / 15.0;
+
+	Frontend &stats = it->second.frontendStats[frontend];
+	if (stats.samples == 0) {
+		stats.level = l;
+		stats.quality = q;
+	} else {
+		stats.level += (l - stats.level) * TUNER_SAMPLE_WEIGHT;
+		stats.quality += (q - stats.quality) * TUNER_SAMPLE_WEIGHT;
+	}
+	stats.samples++;
+}
+
+void TunerMonitor::acquired(const std::string &address, int frontend, int frequency)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State>::iterator it = servers.find(address);
+	if (it == servers.end())
+		return;
+
+	it->second.local++;
+	if (frontend != 0) {
+		it->second.tuned.insert(std::make_pair(frontend, frequency));
+		it->second.frontendStats[frontend].sessions++;
+	}
+}
+
+void TunerMonitor::released(const std::string &address, int frontend)
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	std::map<std::string, State>::iterator it = servers.find(address);
+	if (it == servers.end())
+		return;
+
+	State &state = it->second;
+	if (state.streams + state.local > 0)
+		state.local--;
+
+	std::multimap<int, int>::iterator t = state.tuned.find(frontend);
+	if (t != state.tuned.end())
+		state.tuned.erase(t);
+}
+
+void TunerMonitor::logDiagnostics(void) const
+{
+	P8PLATFORM::CLockObject lock(mutex);
+
+	time_t now = time(NULL);
+	for (std::map<std::string, State>::const_iterator it = servers.begin(); it != servers.end(); ++it) {
+		const State &state = it->second;
+
+		if (!state.reachable || state.frontends < 0) {
+			libKodi->Log(LOG_NOTICE, "diagnostics: tuners %s unknown, %zu polls, %zu failures",
+					it->first.c_str(), state.polls, state.failures);
+		} else {
+			libKodi->Log(LOG_NOTICE, "diagnostics: tuners %s %d/%d busy (%d reported %lld s ago, %+d local), %zu polls, %zu failures",
+					it->first.c_str(), state.streams + state.local, state.frontends, state.streams,
+					(long long)(now - state.updated), state.local, state.polls, state.failures);
+		}
+
+		for (std::map<int, Frontend>::const_iterator f = state.frontendStats.begin(); f != state.frontendStats.end(); ++f) {
+			const Frontend &stats = f->second;
+			libKodi->Log(LOG_NOTICE, "diagnostics: frontend %d %s, level %.0f%% quality %.0f%% (%zu samples), %zu sessions, %zu refused",
+					f->first, state.tuned.count(f->first) > 0 ? "busy" : "idle",
+					stats.level * 100, stats.quality * 100, stats.samples, stats.sessions, stats.failures);
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include <p8-platform/threads/mutex.h>
+
+struct rtsp_server_status;
+
+/*
+ * Keeps track of how many frontends of each server are in use, so a stream
+ * can be sent to a server with a free tuner instead of finding out through a
+ * failing SETUP. Servers are asked with a SAT>IP DESCRIBE on the RTSP root
+ * every few seconds; streams opened and closed by us in between are counted
+ * locally until the next answer.
+ *
+ * Per frontend, the signal level and quality reported via RTCP are kept, so
+ * new streams can be pinned to the frontend that received best so far.
+ */
+class TunerMonitor
+{
+	public:
+		TunerMonitor(void);
+
+		void setServers(const std::vector<std::string> &addresses);
+
+		bool isDue(time_t now) const { return now >= nextPoll; }
+		void poll(time_t now);
+		/* Ask one server right away */
+		void refresh(const std::string &address);
+
+		/* Number of free frontends, -1 if unknown */
+		int getFree(const std::string &address) const;
+
+		/* Frontend to request for a stream of the given delivery system
+		 * and frequency in MHz, 0 to let the server choose */
+		int pickFrontend(const std::string &address, const std::string &system, int frequency) const;
+		/* SETUP with the given frontend was refused */
+		void frontendFailed(const std::string &address, int frontend, const std::string &system);
+		/* Signal as reported via RTCP */
+		void sample(const std::string &address, int frontend, int level, int quality);
+
+		/* frontend is 0 if the server chose one */
+		void acquired(const std::string &address, int frontend, int frequency);
+		void released(const std::string &address, int frontend);
+
+		void logDiagnostics(void) const;
+
+	private:
+		struct Frontend
+		{
+			/* Moving averages, normalized to [0, 1] */
+			double level;
+			double quality;
+			size_t samples;
+			size_t sessions;
+			size_t failures;
+			/* Delivery systems the frontend refused, and until when
+			 * it is not asked for them again */
+			std::map<std::string, time_t> refused;
+
+			Frontend(void) : level(0), quality(0), samples(0), sessions(0), failures(0) {}
+			double getScore(void) const;
+		};
+
+		struct State
+		{
+			/* As last reported by the server, -1 if unknown */
+			int frontends;
+			int streams;
+			/* Streams we opened minus streams we closed since */
+			int local;
+			bool reachable;
+			time_t updated;
+			size_t polls;
+			size_t failures;
+			/* Frequency every busy frontend is tuned to, one entry
+			 * per stream */
+			std::multimap<int, int> tuned;
+			std::map<int, Frontend> frontendStats;
+		};
+
+		void store(const std::string &address, bool ok, const rtsp_server_status &status, time_t now);
+
+		mutable P8PLATFORM::CMutex mutex;
+		std::map<std::string, State> servers;
+		std::atomic<time_t> nextPoll;
+};
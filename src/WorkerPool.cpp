@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "WorkerPool.h"
+
+static void work(std::atomic<size_t> &next, size_t count, const std::function<void(size_t)> &task)
+{
+	size_t i;
+	while ((i = next.fetch_add(1)) < count)
+		task(i);
+}
+
+unsigned WorkerPool::defaultThreads(unsigned max)
+{
+	unsigned n = std::thread::hardware_concurrency();
+	if (n == 0)
+		n = 1;
+
+	return n < max ? n : max;
+}
+
+void WorkerPool::run(size_t count, unsigned threads, const std::function<void(size_t)> &task)
+{
+	std::atomic<size_t> next(0);
+
+	if (threads > count)
+		threads = count;
+
+	/* Joined before next and task go out of scope, even if a worker only
+	 * gets scheduled once all tasks are done */
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < threads; i++) {
+		try {
+			workers.push_back(std::thread(work, std::ref(next), count, std::cref(task)));
+		} catch (const std::system_error &) {
+			break;
+		}
+	}
+
+	/* The calling thread takes part as well */
+	work(next, count, task);
+
+	for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+		it->join();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+ * Copyright (C) 2015 Julian Scheel <julian@jusst.de>
+ * Copyright (C) 2015 jusst technologies GmbH
+ * Copyright (C) 2015 Digital Devices GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ *
+ */
+
+#include <functional>
+#include <stddef.h>
+
+/*
+ * Runs a set of independent tasks on a few short lived threads. Tasks are
+ * handed out one at a time in the given order, so callers should put the
+ * most expensive ones first.
+ */
+class WorkerPool
+{
+	public:
+		/* Number of threads worth using on this machine, capped at max */
+		static unsigned defaultThreads(unsigned max = 4);
+
+		/* Calls task(i) for every i in [0, count) using up to threads
+		 * threads including the calling one, returns when all are done */
+		static void run(size_t count, unsigned threads, const std::function<void(size_t)> &task);
+};
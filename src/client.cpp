@@ -21,25 +21,64 @@
  */
 
 #include "client.h"
+#include <algorithm>
+#include <sstream>
 #include <xbmc_pvr_dll.h>
 #include <libXBMC_addon.h>
 #include <p8-platform/util/util.h>
 #include <libKODI_guilib.h>
 
 #include "OctonetData.h"
-#include "rtsp_client.hpp"
+#include "Recorder.h"
+#include "SessionManager.h"
+#include "TsDemuxer.h"
+#include "TsPidFilter.h"
 
 using namespace ADDON;
 
+#define MENUHOOK_DIAGNOSTICS 1
+
 /* setting variables with defaults */
 std::string octonetAddress = "";
+bool useDemuxer = false;
+bool fastStart = true;
+/* MiB of live TV kept for timeshift, 0 to disable */
+int timeshiftSize = 0;
+/* GiB of live TV kept on disk instead, 0 to disable */
+int timeshiftDiskSize = 0;
 
 /* internal state variables */
 ADDON_STATUS addonStatus = ADDON_STATUS_UNKNOWN;
 CHelper_libXBMC_addon *libKodi = NULL;
 CHelper_libXBMC_pvr *pvr = NULL;
 
+std::string userPath;
 OctonetData *data = NULL;
+int currentChannel = PVR_CHANNEL_INVALID_UID;
+SessionManager *sessions = NULL;
+Recorder *recorder = NULL;
+StreamConsumer *liveStream = NULL;
+/* The recording being played, its id and when it was recorded */
+void *recordedFile = NULL;
+std::string recordedId;
+time_t recordedStart = 0;
+int recordedDuration = 0;
+TsDemuxer *demuxer = NULL;
+P8PLATFORM::CMutex demuxMutex;
+
+/* The disk takes precedence, it holds more */
+static void applyTimeshift(void)
+{
+	if (timeshiftDiskSize > 0)
+		sessions->setTimeshift((uint64_t)timeshiftDiskSize << 30, userPath + "timeshift");
+	else
+		sessions->setTimeshift((uint64_t)timeshiftSize << 20, std::string());
+}
+
+static bool hasTimeshift(void)
+{
+	return timeshiftSize > 0 || timeshiftDiskSize > 0;
+}
 
 /* KODI Core Addon functions
  * see xbmc_addon_dll.h */
@@ -51,6 +90,14 @@ void ADDON_ReadSettings(void)
 	char buffer[2048];
 	if (libKodi->GetSetting("octonetAddress", &buffer))
 		octonetAddress = buffer;
+	if (!libKodi->GetSetting("useDemuxer", &useDemuxer))
+		useDemuxer = false;
+	if (!libKodi->GetSetting("fastStart", &fastStart))
+		fastStart = true;
+	if (!libKodi->GetSetting("timeshiftSize", &timeshiftSize))
+		timeshiftSize = 0;
+	if (!libKodi->GetSetting("timeshiftDiskSize", &timeshiftDiskSize))
+		timeshiftDiskSize = 0;
 }
 
 ADDON_STATUS ADDON_Create(void *callbacks, void* props)
@@ -77,7 +124,22 @@ ADDON_STATUS ADDON_Create(void *callbacks, void* props)
 	libKodi->Log(LOG_DEBUG, "%s: Creating octonet pvr addon", __func__);
 	ADDON_ReadSettings();
 
-	data = new OctonetData;
+	userPath = pvrprops->strUserPath;
+	if (!userPath.empty() && userPath[userPath.size() - 1] != '/' && userPath[userPath.size() - 1] != '\\')
+		userPath += "/";
+
+	data = new OctonetData(octonetAddress, pvrprops->iEpgMaxDays);
+	sessions = new SessionManager(*data);
+	sessions->setFastStart(fastStart);
+	applyTimeshift();
+	recorder = new Recorder(*data, *sessions, userPath + "recordings");
+
+	PVR_MENUHOOK hook;
+	memset(&hook, 0, sizeof(PVR_MENUHOOK));
+	hook.iHookId = MENUHOOK_DIAGNOSTICS;
+	hook.iLocalizedStringId = 30002;
+	hook.category = PVR_MENUHOOK_SETTING;
+	pvr->AddMenuHook(&hook);
 
 	addonStatus = ADDON_STATUS_OK;
 	return addonStatus;
@@ -85,6 +147,11 @@ ADDON_STATUS ADDON_Create(void *callbacks, void* props)
 
 void ADDON_Destroy()
 {
+	liveStream = NULL;
+	/* Its streams are closed through the sessions */
+	SAFE_DELETE(recorder);
+	SAFE_DELETE(sessions);
+	SAFE_DELETE(data);
 	delete pvr;
 	delete libKodi;
 	addonStatus = ADDON_STATUS_UNKNOWN;
@@ -97,8 +164,32 @@ ADDON_STATUS ADDON_GetStatus()
 
 ADDON_STATUS ADDON_SetSetting(const char *settingName, const void *settingValue)
 {
-	/* For simplicity do a full addon restart whenever settings are
-	 * changed */
+	if (strcmp(settingName, "octonetAddress") == 0) {
+		if (data)
+			data->setServerAddress((const char *)settingValue);
+		else
+			octonetAddress = (const char *)settingValue;
+		return ADDON_STATUS_OK;
+	}
+
+	if (strcmp(settingName, "fastStart") == 0) {
+		fastStart = *(const bool *)settingValue;
+		if (sessions)
+			sessions->setFastStart(fastStart);
+		return ADDON_STATUS_OK;
+	}
+
+	if (strcmp(settingName, "timeshiftSize") == 0 || strcmp(settingName, "timeshiftDiskSize") == 0) {
+		if (strcmp(settingName, "timeshiftSize") == 0)
+			timeshiftSize = *(const int *)settingValue;
+		else
+			timeshiftDiskSize = *(const int *)settingValue;
+		if (sessions)
+			applyTimeshift();
+		return ADDON_STATUS_OK;
+	}
+
+	/* Anything unknown needs a full addon restart */
 	return ADDON_STATUS_NEED_RESTART;
 }
 
@@ -116,10 +207,13 @@ PVR_ERROR GetAddonCapabilities(PVR_ADDON_CAPABILITIES *pCapabilities)
 	pCapabilities->bSupportsRadio = true;
 	pCapabilities->bSupportsChannelGroups = true;
 	pCapabilities->bSupportsEPG = true;
-	pCapabilities->bSupportsRecordings = false;
+	pCapabilities->bSupportsRecordings = true;
+	pCapabilities->bSupportsTimers = true;
 	pCapabilities->bSupportsRecordingsRename = false;
 	pCapabilities->bSupportsRecordingsLifetimeChange = false;
 	pCapabilities->bSupportsDescrambleInfo = false;
+	pCapabilities->bHandlesInputStream = true;
+	pCapabilities->bHandlesDemuxing = useDemuxer;
 
 	return PVR_ERROR_NO_ERROR;
 }
@@ -140,7 +234,19 @@ const char* GetConnectionString(void)
 }
 
 PVR_ERROR GetDriveSpace(long long* iTotal, long long* iUsed) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR CallMenuHook(const PVR_MENUHOOK& menuhook, const PVR_MENUHOOK_DATA &item) { return PVR_ERROR_NOT_IMPLEMENTED; }
+
+PVR_ERROR CallMenuHook(const PVR_MENUHOOK& menuhook, const PVR_MENUHOOK_DATA &item)
+{
+	if (menuhook.iHookId != MENUHOOK_DIAGNOSTICS)
+		return PVR_ERROR_NOT_IMPLEMENTED;
+
+	data->logDiagnostics();
+	sessions->logDiagnostics();
+	char *done = libKodi->GetLocalizedString(30003);
+	libKodi->QueueNotification(QUEUE_INFO, done);
+	libKodi->FreeString(done);
+	return PVR_ERROR_NO_ERROR;
+}
 
 void OnSystemSleep() {
 	libKodi->Log(LOG_INFO, "Received event: %s", __FUNCTION__);
@@ -199,9 +305,22 @@ PVR_ERROR OpenDialogChannelSettings(const PVR_CHANNEL& channel) { return PVR_ERR
 PVR_ERROR OpenDialogChannelAdd(const PVR_CHANNEL& channel) { return PVR_ERROR_NOT_IMPLEMENTED; }
 
 /* Recordings */
-int GetRecordingsAmount(bool deleted) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR GetRecordings(ADDON_HANDLE handle, bool deleted) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR DeleteRecording(const PVR_RECORDING& recording) { return PVR_ERROR_NOT_IMPLEMENTED; }
+int GetRecordingsAmount(bool deleted) {
+	return deleted ? 0 : recorder->getRecordingCount();
+}
+
+PVR_ERROR GetRecordings(ADDON_HANDLE handle, bool deleted) {
+	/* Deleted recordings are gone right away */
+	if (deleted)
+		return PVR_ERROR_NO_ERROR;
+
+	return recorder->getRecordings(handle);
+}
+
+PVR_ERROR DeleteRecording(const PVR_RECORDING& recording) {
+	return recorder->deleteRecording(recording);
+}
+
 PVR_ERROR UndeleteRecording(const PVR_RECORDING& recording) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR DeleteAllRecordingsFromTrash() { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR RenameRecording(const PVR_RECORDING& recording) { return PVR_ERROR_NOT_IMPLEMENTED; }
@@ -210,12 +329,14 @@ PVR_ERROR SetRecordingPlayCount(const PVR_RECORDING& recording, int count) { ret
 PVR_ERROR SetRecordingLastPlayedPosition(const PVR_RECORDING& recording, int lastplayedposition) { return PVR_ERROR_NOT_IMPLEMENTED; }
 int GetRecordingLastPlayedPosition(const PVR_RECORDING& recording) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR GetRecordingEdl(const PVR_RECORDING&, PVR_EDL_ENTRY edl[], int *size) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR GetTimerTypes(PVR_TIMER_TYPE types[], int *size) { return PVR_ERROR_NOT_IMPLEMENTED; }
-int GetTimersAmount(void) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR GetTimers(ADDON_HANDLE handle) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR AddTimer(const PVR_TIMER& timer) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR DeleteTimer(const PVR_TIMER& timer, bool bForceDelete) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR UpdateTimer(const PVR_TIMER& timer) { return PVR_ERROR_NOT_IMPLEMENTED; }
+
+/* Timers */
+PVR_ERROR GetTimerTypes(PVR_TIMER_TYPE types[], int *size) { return recorder->getTimerTypes(types, size); }
+int GetTimersAmount(void) { return recorder->getTimerCount(); }
+PVR_ERROR GetTimers(ADDON_HANDLE handle) { return recorder->getTimers(handle); }
+PVR_ERROR AddTimer(const PVR_TIMER& timer) { return recorder->addTimer(timer); }
+PVR_ERROR DeleteTimer(const PVR_TIMER& timer, bool bForceDelete) { return recorder->deleteTimer(timer, bForceDelete); }
+PVR_ERROR UpdateTimer(const PVR_TIMER& timer) { return recorder->updateTimer(timer); }
 
 /* PVR stream properties handling */
 PVR_ERROR GetStreamReadChunkSize(int* chunksize) { return PVR_ERROR_NOT_IMPLEMENTED; }
@@ -225,62 +346,311 @@ PVR_ERROR GetEPGTagStreamProperties(const EPG_TAG*, PVR_NAMED_VALUE*, unsigned i
 PVR_ERROR GetEPGTagEdl(const EPG_TAG* epgTag, PVR_EDL_ENTRY edl[], int *size) { return PVR_ERROR_NOT_IMPLEMENTED; }
 
 /* PVR stream handling */
-/* entirely unused, as we use standard RTSP+TS mux, which can be handlded by
- * Kodi core */
+/* A live stream without any data for this long is considered dead */
+#define LIVE_READ_TIMEOUT 10000
+
 bool OpenLiveStream(const PVR_CHANNEL& channel) {
-	return rtsp_open(data->getName(channel.iUniqueId), data->getUrl(channel.iUniqueId));
+	/* Free our tuner before looking for one */
+	CloseLiveStream();
+
+	currentChannel = channel.iUniqueId;
+	liveStream = sessions->open(channel.iUniqueId);
+	if (liveStream != NULL && useDemuxer) {
+		P8PLATFORM::CLockObject lock(demuxMutex);
+		demuxer = new TsDemuxer;
+	}
+
+	return liveStream != NULL;
 }
 
 int ReadLiveStream(unsigned char* pBuffer, unsigned int iBufferSize) {
-	return rtsp_read(pBuffer, iBufferSize);
+	if (liveStream == NULL)
+		return -1;
+
+	return liveStream->read(pBuffer, iBufferSize, LIVE_READ_TIMEOUT);
 }
 
 void CloseLiveStream(void) {
-	rtsp_close();
+	{
+		P8PLATFORM::CLockObject lock(demuxMutex);
+		SAFE_DELETE(demuxer);
+	}
+
+	if (liveStream != NULL) {
+		sessions->close(liveStream);
+		liveStream = NULL;
+	}
 }
 
-long long SeekLiveStream(long long iPosition, int iWhence) { return -1; }
-long long LengthLiveStream(void) { return -1; }
-bool IsRealTimeStream(void) { return true; }
+long long SeekLiveStream(long long iPosition, int iWhence) {
+	if (liveStream == NULL || !hasTimeshift())
+		return -1;
+
+	return liveStream->seek(iPosition, iWhence);
+}
+
+long long LengthLiveStream(void) {
+	if (liveStream == NULL || !hasTimeshift())
+		return -1;
+
+	return liveStream->getLength();
+}
+
+bool IsRealTimeStream(void) {
+	if (recordedFile != NULL)
+		return false;
+
+	return liveStream == NULL || !liveStream->isTimeshifting();
+}
 
 PVR_ERROR SignalStatus(PVR_SIGNAL_STATUS& signalStatus) {
 	memset(&signalStatus, 0, sizeof(PVR_SIGNAL_STATUS));
-	rtsp_fill_signal_status(signalStatus);
+	if (liveStream != NULL)
+		sessions->fillSignalStatus(liveStream, signalStatus);
+
+	std::string now, next;
+	if (signalStatus.strServiceName[0] != '\0' && data->getNowNext(currentChannel, now, next)) {
+		std::string name = std::string(signalStatus.strServiceName) + " - " + now;
+		strncpy(signalStatus.strServiceName, name.c_str(), PVR_ADDON_NAME_STRING_LENGTH - 1);
+	}
+
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR GetStreamTimes(PVR_STREAM_TIMES *times) {
+	if (liveStream == NULL || !hasTimeshift())
+		return PVR_ERROR_NOT_IMPLEMENTED;
+
+	/* Times count from the first PCR, like the demuxer's timestamps */
+	int64_t begin, end;
+	time_t startTime;
+	if (!liveStream->getTimes(begin, end, startTime))
+		return PVR_ERROR_NOT_IMPLEMENTED;
+
+	times->startTime = startTime;
+	times->ptsStart = 0;
+	times->ptsBegin = begin;
+	times->ptsEnd = end;
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR GetStreamProperties(PVR_STREAM_PROPERTIES* pProperties) {
+	if (recordedFile != NULL) {
+		P8PLATFORM::CLockObject lock(demuxMutex);
+		TsProgramMap map;
+		if (demuxer == NULL || !demuxer->getProgramMap(map) ||
+				!SessionManager::fillStreamProperties(map, *pProperties))
+			return PVR_ERROR_NOT_IMPLEMENTED;
+
+		return PVR_ERROR_NO_ERROR;
+	}
+
+	if (liveStream == NULL)
+		return PVR_ERROR_REJECTED;
+
+	/* Without a PMT Kodi has to probe the stream itself */
+	if (!sessions->fillStreamProperties(liveStream, *pProperties))
+		return PVR_ERROR_NOT_IMPLEMENTED;
+
 	return PVR_ERROR_NO_ERROR;
 }
 
-PVR_ERROR GetStreamTimes(PVR_STREAM_TIMES *times) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR GetStreamProperties(PVR_STREAM_PROPERTIES* pProperties) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR GetDescrambleInfo(PVR_DESCRAMBLE_INFO*) { return PVR_ERROR_NOT_IMPLEMENTED; }
 
 /* Recording stream handling */
-bool OpenRecordedStream(const PVR_RECORDING& recording) { return false; }
-void CloseRecordedStream(void) {}
-int ReadRecordedStream(unsigned char* pBuffer, unsigned int iBufferSize) { return -1; }
-long long SeekRecordedStream(long long iPosition, int iWhence) { return -1; }
-long long LengthRecordedStream(void) { return -1; }
+/* How long a read at the end of a running recording waits for more */
+#define RECORDING_CHASE_TIMEOUT 5000
+#define RECORDING_CHASE_INTERVAL 100
+
+void CloseRecordedStream(void) {
+	if (recordedFile == NULL)
+		return;
+
+	{
+		P8PLATFORM::CLockObject lock(demuxMutex);
+		SAFE_DELETE(demuxer);
+	}
+
+	libKodi->CloseFile(recordedFile);
+	recordedFile = NULL;
+}
+
+bool OpenRecordedStream(const PVR_RECORDING& recording) {
+	CloseRecordedStream();
+
+	std::string path;
+	if (!recorder->getRecordingPath(recording.strRecordingId, path))
+		return false;
+
+	recordedFile = libKodi->OpenFile(path.c_str(), XFILE::READ_NO_CACHE);
+	if (recordedFile == NULL)
+		return false;
+
+	recordedId = recording.strRecordingId;
+	recordedStart = recording.recordingTime;
+	recordedDuration = recording.iDuration;
+	if (useDemuxer) {
+		P8PLATFORM::CLockObject lock(demuxMutex);
+		demuxer = new TsDemuxer(true);
+	}
+
+	return true;
+}
+
+int ReadRecordedStream(unsigned char* pBuffer, unsigned int iBufferSize) {
+	if (recordedFile == NULL)
+		return -1;
+
+	/* A recording that is still running grows, playback follows it */
+	for (int waited = 0; ; waited += RECORDING_CHASE_INTERVAL) {
+		ssize_t length = libKodi->ReadFile(recordedFile, pBuffer, iBufferSize);
+		if (length != 0 || waited >= RECORDING_CHASE_TIMEOUT || !recorder->isRecording(recordedId))
+			return length;
+
+		P8PLATFORM::CEvent::Sleep(RECORDING_CHASE_INTERVAL);
+	}
+}
+
+long long SeekRecordedStream(long long iPosition, int iWhence) {
+	if (recordedFile == NULL)
+		return -1;
+
+	return libKodi->SeekFile(recordedFile, iPosition, iWhence);
+}
+
+long long LengthRecordedStream(void) {
+	if (recordedFile == NULL)
+		return -1;
+
+	return libKodi->GetFileLength(recordedFile);
+}
 
 /* PVR demuxer */
-/* entirey unused, as we use TS */
-void DemuxReset(void) {}
-void DemuxAbort(void) {}
-void DemuxFlush(void) {}
-DemuxPacket* DemuxRead(void) { return NULL; }
+/* Only used if the built-in demuxer is enabled, Kodi demuxes the TS of
+ * ReadLiveStream otherwise */
+/* Keeps DemuxRead responsive to DemuxAbort */
+#define DEMUX_READ_TIMEOUT 100
+#define DEMUX_READ_PACKETS 348
+
+void DemuxReset(void) {
+	P8PLATFORM::CLockObject lock(demuxMutex);
+	if (demuxer != NULL)
+		demuxer->reset();
+}
+
+void DemuxAbort(void) {
+	P8PLATFORM::CLockObject lock(demuxMutex);
+	if (demuxer != NULL)
+		demuxer->flush();
+}
+
+void DemuxFlush(void) {
+	P8PLATFORM::CLockObject lock(demuxMutex);
+	if (demuxer != NULL)
+		demuxer->flush();
+}
+
+DemuxPacket* DemuxRead(void) {
+	static unsigned char buffer[DEMUX_READ_PACKETS * TS_PACKET_SIZE];
+
+	P8PLATFORM::CLockObject lock(demuxMutex);
+	if ((liveStream == NULL && recordedFile == NULL) || demuxer == NULL)
+		return NULL;
+
+	DemuxPacket *packet = demuxer->pop();
+	if (packet != NULL)
+		return packet;
+
+	/* A recording brings its own PAT and PMT, the demuxer follows them */
+	if (liveStream == NULL) {
+		ssize_t length = libKodi->ReadFile(recordedFile, buffer, sizeof(buffer));
+		if (length <= 0 && !recorder->isRecording(recordedId))
+			return NULL;
+		demuxer->push(buffer, std::max(length, (ssize_t)0) / TS_PACKET_SIZE);
+
+		packet = demuxer->pop();
+		return packet != NULL ? packet : pvr->AllocateDemuxPacket(0);
+	}
+
+	int length = liveStream->read(buffer, sizeof(buffer), DEMUX_READ_TIMEOUT);
+
+	/* The PMT is parsed by the session before its packets get here */
+	TsProgramMap map;
+	if (liveStream->getProgramMap(map, 0))
+		demuxer->setProgramMap(map);
+	/* Packet times follow the time index, also after a seek or lost
+	 * data, so they match the stream times and seek targets */
+	TsClock clock;
+	if (liveStream->takeClock(clock))
+		demuxer->setClock(clock);
+	demuxer->push(buffer, length / TS_PACKET_SIZE);
+
+	/* An empty packet tells Kodi there is nothing yet */
+	packet = demuxer->pop();
+	return packet != NULL ? packet : pvr->AllocateDemuxPacket(0);
+}
 
 /* Various helper functions */
-bool IsTimeshifting(void) { return false; }
-bool CanPauseStream() { return false; }
-bool CanSeekStream() { return false; }
+bool IsTimeshifting(void) {
+	return liveStream != NULL && liveStream->isTimeshifting();
+}
+
+bool CanPauseStream() { return recordedFile != NULL || hasTimeshift(); }
+/* By bytes with Kodi's demuxer, by time with the built-in one */
+bool CanSeekStream() { return recordedFile != NULL || hasTimeshift(); }
 
 /* Callbacks */
-void PauseStream(bool bPaused) {}
-bool SeekTime(double time, bool backwards, double *startpts) { return false; }
+void PauseStream(bool bPaused) {
+	if (liveStream != NULL)
+		liveStream->pause(bPaused);
+}
+
+/* Recordings carry no index, the position is estimated from the bitrate */
+static bool seekRecordedTime(double time, double *startpts) {
+	int duration = recorder->isRecording(recordedId) ? (int)(::time(NULL) - recordedStart) : recordedDuration;
+	int64_t length = libKodi->GetFileLength(recordedFile);
+	if (duration <= 0 || length <= 0)
+		return false;
+
+	int64_t position = (int64_t)(time / 1000 / duration * length);
+	position = std::max((int64_t)0, std::min(position, length)) / TS_PACKET_SIZE * TS_PACKET_SIZE;
+	if (libKodi->SeekFile(recordedFile, position, SEEK_SET) < 0)
+		return false;
+
+	/* Packet times continue from the seek target, not from before it */
+	demuxer->flush();
+	demuxer->setTime((int64_t)(time * TS_CLOCK_RATE / 1000));
+	*startpts = time * 1000;
+	return true;
+}
+
+bool SeekTime(double time, bool backwards, double *startpts) {
+	P8PLATFORM::CLockObject lock(demuxMutex);
+	if (recordedFile != NULL && demuxer != NULL)
+		return seekRecordedTime(time, startpts);
+
+	if (liveStream == NULL || demuxer == NULL || !hasTimeshift())
+		return false;
+
+	int64_t pts;
+	if (!liveStream->seekTime((int64_t)time, backwards, pts))
+		return false;
+
+	/* Nothing demuxed before the seek may come out after it */
+	demuxer->flush();
+	*startpts = pts;
+	return true;
+}
 void SetSpeed(int speed) {}
-PVR_ERROR SetEPGTimeFrame(int) { return PVR_ERROR_NOT_IMPLEMENTED; }
+PVR_ERROR SetEPGTimeFrame(int iDays)
+{
+	data->setEpgTimeFrame(iDays);
+	return PVR_ERROR_NO_ERROR;
+}
 
 const char* GetBackendHostname()
 {
-	return octonetAddress.c_str();
+	return data != NULL ? data->getServerAddress() : "";
 }
 
 }
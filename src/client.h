@@ -30,6 +30,3 @@
 
 extern ADDON::CHelper_libXBMC_addon *libKodi;
 extern CHelper_libXBMC_pvr *pvr;
-
-/* IP or hostname of the octonet to be connected to */
-extern std::string octonetAddress;
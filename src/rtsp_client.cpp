@@ -31,6 +31,8 @@ int asprintf(char **sptr, char *fmt, ...) {
 #endif
 
 #define RTSP_DEFAULT_PORT 554
+#define RTP_PORT_FIRST 6785
+#define RTP_PORT_TRIES 32
 #define RTSP_RECEIVE_BUFFER 2048
 #define RTP_HEADER_SIZE 12
 #define VLEN 100
@@ -75,7 +77,11 @@ struct rtsp_client {
 	size_t fifo_size;
 	uint16_t last_seq_nr;
 
+	string tcp_buf;
+	time_t last_keepalive;
+
 	string name;
+	int frontend;
 	int level;
 	int quality;
 };
@@ -97,8 +103,6 @@ struct rtcp_app {
 	uint16_t string_len;
 };
 
-static rtsp_client *rtsp = NULL;
-
 static url parse_url(const std::string& str) {
 	static const string prot_end = "://";
 	static const string host_end = "/";
@@ -135,9 +139,7 @@ void split_string(const string& s, char delim, vector<string>& elems) {
 	}
 }
 
-static int tcp_sock_read_line(string &line) {
-	static string buf;
-
+static int sock_read_line(Socket &sock, string &buf, string &line) {
 	while(true) {
 		string::size_type pos = buf.find("\r\n");
 		if(pos != string::npos) {
@@ -147,7 +149,7 @@ static int tcp_sock_read_line(string &line) {
 		}
 
 		char tmp_buf[2048];
-		int size = rtsp->tcp_sock.receive(tmp_buf, sizeof(tmp_buf), 1);
+		int size = sock.receive(tmp_buf, sizeof(tmp_buf), 1);
 		if(size <= 0) {
 			return 1;
 		}
@@ -156,6 +158,10 @@ static int tcp_sock_read_line(string &line) {
 	}
 }
 
+static int tcp_sock_read_line(rtsp_client *rtsp, string &line) {
+	return sock_read_line(rtsp->tcp_sock, rtsp->tcp_buf, line);
+}
+
 static string compose_url(const url& u)
 {
 	stringstream res;
@@ -198,7 +204,7 @@ static int parse_port(char *str, uint16_t *port)
 	return 0;
 }
 
-static int parse_transport(char *request_line) {
+static int parse_transport(rtsp_client *rtsp, char *request_line) {
 	char *state;
 	char *tok;
 	int err;
@@ -232,7 +238,7 @@ static int parse_transport(char *request_line) {
 }
 
 #define skip_whitespace(x) while(*x == ' ') x++
-static enum rtsp_result rtsp_handle() {
+static enum rtsp_result rtsp_handle(rtsp_client *rtsp) {
 	uint8_t buffer[512];
 	int rtsp_result = 0;
 	bool have_header = false;
@@ -243,7 +249,7 @@ static enum rtsp_result rtsp_handle() {
 
 	/* Parse header */
 	while (!have_header) {
-		if (tcp_sock_read_line(in_str) < 0)
+		if (tcp_sock_read_line(rtsp, in_str) != 0)
 			break;
 		in = const_cast<char *>(in_str.c_str());
 
@@ -270,7 +276,7 @@ static enum rtsp_result rtsp_handle() {
 			val = in + 10;
 			skip_whitespace(val);
 
-			if (parse_transport(val) != 0) {
+			if (parse_transport(rtsp, val) != 0) {
 				rtsp_result = -1;
 				break;
 			}
@@ -292,20 +298,20 @@ static enum rtsp_result rtsp_handle() {
 	return (enum rtsp_result)rtsp_result;
 }
 
-bool rtsp_open(const string& name, const string& url_str)
+rtsp_client *rtsp_open(const string& name, const string& url_str)
 {
 	string setup_url_str;
-	const char *psz_setup_url;
 	stringstream setup_ss;
 	stringstream play_ss;
 	url setup_url;
+	int tries;
 
-	rtsp_close();
-	rtsp = new rtsp_client();
+	rtsp_client *rtsp = new rtsp_client();
 	if (rtsp == NULL)
-		return false;
+		return NULL;
 
 	rtsp->name = name;
+	rtsp->frontend = 0;
 	rtsp->level = 0;
 	rtsp->quality = 0;
 
@@ -328,6 +334,7 @@ bool rtsp_open(const string& name, const string& url_str)
 	}
 
 	rtsp->last_seq_nr = 0;
+	rtsp->last_keepalive = time(NULL);
 	rtsp->keepalive_interval = (KEEPALIVE_INTERVAL - KEEPALIVE_MARGIN);
 
 	setup_url = dst;
@@ -338,12 +345,20 @@ bool rtsp_open(const string& name, const string& url_str)
 	}
 
 	setup_url_str = compose_url(setup_url);
-	psz_setup_url = setup_url_str.c_str();
 
-	// TODO: Find available port
+	/* Every session needs its own pair of RTP and RTCP ports */
 	rtsp->udp_sock = Socket(af_inet, pf_inet, sock_dgram, udp);
-	rtsp->udp_port = 6785;
-	if(!rtsp->udp_sock.bind(rtsp->udp_port)) {
+	rtsp->rtcp_sock = Socket(af_inet, pf_inet, sock_dgram, udp);
+	for (tries = 0; tries < RTP_PORT_TRIES; tries++) {
+		rtsp->udp_port = RTP_PORT_FIRST + 2 * tries;
+		if (rtsp->udp_sock.bind(rtsp->udp_port) && rtsp->rtcp_sock.bind(rtsp->udp_port + 1))
+			break;
+	}
+	if (tries == RTP_PORT_TRIES) {
+		libKodi->Log(LOG_ERROR, "No free RTP port");
+		goto error;
+	}
+	if(!rtsp->rtcp_sock.set_non_blocking(true)) {
 		goto error;
 	}
 
@@ -352,7 +367,7 @@ bool rtsp_open(const string& name, const string& url_str)
 	setup_ss << "Transport: RTP/AVP;unicast;client_port=" << rtsp->udp_port << "-" << (rtsp->udp_port + 1) << "\r\n\r\n";
 	rtsp->tcp_sock.send(setup_ss.str());
 
-	if (rtsp_handle() != RTSP_RESULT_OK) {
+	if (rtsp_handle(rtsp) != RTSP_RESULT_OK) {
 		libKodi->Log(LOG_ERROR, "Failed to setup RTSP session");
 		goto error;
 	}
@@ -367,27 +382,164 @@ bool rtsp_open(const string& name, const string& url_str)
 	play_ss << "Session: " << rtsp->session_id << "\r\n\r\n";
 	rtsp->tcp_sock.send(play_ss.str());
 
-	if (rtsp_handle() != RTSP_RESULT_OK) {
+	if (rtsp_handle(rtsp) != RTSP_RESULT_OK) {
 		libKodi->Log(LOG_ERROR, "Failed to play RTSP session");
 		goto error;
 	}
 
-	rtsp->rtcp_sock = Socket(af_inet, pf_inet, sock_dgram, udp);
-	if(!rtsp->rtcp_sock.bind(rtsp->udp_port + 1)) {
-		goto error;
+	return rtsp;
+
+error:
+	rtsp_close(rtsp);
+	return NULL;
+}
+
+bool rtsp_update_pids(rtsp_client *rtsp, const string& addpids, const string& delpids)
+{
+	stringstream ss;
+	const char *sep = "?";
+
+	ss << "PLAY " << rtsp->control;
+	if (!addpids.empty()) {
+		ss << sep << "addpids=" << addpids;
+		sep = "&";
 	}
-	if(!rtsp->rtcp_sock.set_non_blocking(true)) {
-		goto error;
+	if (!delpids.empty())
+		ss << sep << "delpids=" << delpids;
+	ss << " RTSP/1.0\r\n";
+	ss << "CSeq: " << rtsp->cseq++ << "\r\n";
+	ss << "Session: " << rtsp->session_id << "\r\n\r\n";
+	rtsp->tcp_sock.send(ss.str());
+
+	if (rtsp_handle(rtsp) != RTSP_RESULT_OK) {
+		libKodi->Log(LOG_ERROR, "Failed to update pids of RTSP session");
+		return false;
 	}
 
 	return true;
+}
 
-error:
-	rtsp_close();
-	return false;
+bool rtsp_keepalive(rtsp_client *rtsp)
+{
+	time_t now = time(NULL);
+	if (now < rtsp->last_keepalive + rtsp->keepalive_interval)
+		return true;
+
+	stringstream ss;
+	ss << "OPTIONS " << rtsp->content_base << " RTSP/1.0\r\n";
+	ss << "CSeq: " << rtsp->cseq++ << "\r\n";
+	ss << "Session: " << rtsp->session_id << "\r\n\r\n";
+	rtsp->tcp_sock.send(ss.str());
+	rtsp->last_keepalive = now;
+
+	if (rtsp_handle(rtsp) != RTSP_RESULT_OK) {
+		libKodi->Log(LOG_ERROR, "Failed to keep RTSP session alive");
+		return false;
+	}
+
+	return true;
 }
 
-static void parse_rtcp(const char *buf, int size) {
+/* Count the frontends announced in "s=SatIPServer:1 <dvbs>,<dvbt>,<dvbc>" */
+static int parse_satip_server(const string& line) {
+	string::size_type pos = line.find(' ');
+	if (pos == string::npos)
+		return -1;
+
+	vector<string> elems;
+	split_string(line.substr(pos + 1), ',', elems);
+
+	int frontends = 0;
+	for (vector<string>::const_iterator it = elems.begin(); it != elems.end(); ++it)
+		frontends += atoi(it->c_str());
+
+	return frontends;
+}
+
+/* Frontend and frequency from "a=fmtp:33 ver=1.0;src=1;tuner=<fe>,<level>,<lock>,<quality>,<freq>,..." */
+static void parse_fmtp(const string& line, rtsp_server_status& status) {
+	string::size_type pos = line.find("tuner=");
+	if (pos == string::npos)
+		return;
+
+	vector<string> params;
+	split_string(line.substr(pos + 6), ';', params);
+	if (params.empty())
+		return;
+
+	vector<string> tuner;
+	split_string(params[0], ',', tuner);
+	if (tuner.size() < 5)
+		return;
+
+	status.tuned.push_back(make_pair(atoi(tuner[0].c_str()), (int)atof(tuner[4].c_str())));
+}
+
+bool rtsp_describe(const string& url_str, rtsp_server_status& status)
+{
+	Socket sock;
+	string buf;
+	string line;
+	stringstream ss;
+	int result = 0;
+	size_t content_length = 0;
+
+	url dst = parse_url(url_str);
+	if (!sock.connect(dst.host, dst.port)) {
+		libKodi->Log(LOG_DEBUG, "%s: failed to connect to %s:%d", __func__, dst.host.c_str(), dst.port);
+		return false;
+	}
+
+	ss << "DESCRIBE rtsp://" << dst.host << ":" << dst.port << "/ RTSP/1.0\r\n";
+	ss << "CSeq: 1\r\n";
+	ss << "Accept: application/sdp\r\n\r\n";
+	sock.send(ss.str());
+
+	while (sock_read_line(sock, buf, line) == 0 && !line.empty()) {
+		if (strncmp(line.c_str(), "RTSP/1.0 ", 9) == 0)
+			result = atoi(line.c_str() + 9);
+		else if (strncasecmp(line.c_str(), "Content-Length:", 15) == 0)
+			content_length = atoi(line.c_str() + 15);
+	}
+
+	/* Servers answer 404 as long as no stream is set up */
+	status.streams = 0;
+	status.tuned.clear();
+	if (result == 404)
+		return true;
+	if (result != RTSP_RESULT_OK)
+		return false;
+
+	while (buf.size() < content_length) {
+		char tmp_buf[2048];
+		int size = sock.receive(tmp_buf, min(sizeof(tmp_buf), content_length - buf.size()), 0);
+		if (size <= 0)
+			return false;
+		buf.append(&tmp_buf[0], &tmp_buf[size]);
+	}
+
+	/* Every media description is a stream holding a frontend */
+	vector<string> sdp;
+	split_string(buf, '\n', sdp);
+	for (vector<string>::iterator it = sdp.begin(); it != sdp.end(); ++it) {
+		if (!it->empty() && (*it)[it->size() - 1] == '\r')
+			it->erase(it->size() - 1);
+
+		if (it->compare(0, 15, "s=SatIPServer:1") == 0) {
+			int n = parse_satip_server(*it);
+			if (n > 0)
+				status.frontends = n;
+		} else if (it->compare(0, 2, "m=") == 0) {
+			status.streams++;
+		} else if (it->compare(0, 7, "a=fmtp:") == 0) {
+			parse_fmtp(*it, status);
+		}
+	}
+
+	return true;
+}
+
+static void parse_rtcp(rtsp_client *rtsp, const char *buf, int size) {
 	int offset = 0;
 	while(size > 4) {
 		const rtcp_app *app = reinterpret_cast<const rtcp_app *>(buf + offset);
@@ -414,6 +566,7 @@ static void parse_rtcp(const char *buf, int size) {
 			return;
 		}
 
+		rtsp->frontend = atoi(tuner[0].c_str());
 		rtsp->level = atoi(tuner[1].c_str());
 		rtsp->quality = atoi(tuner[3].c_str());
 
@@ -421,21 +574,23 @@ static void parse_rtcp(const char *buf, int size) {
 	}
 }
 
-int rtsp_read(void *buf, unsigned buf_size) {
+int rtsp_read(rtsp_client *rtsp, void *buf, unsigned buf_size, int timeout_ms) {
 	sockaddr addr;
 	socklen_t addr_len = sizeof(addr);
-	int ret = rtsp->udp_sock.recvfrom((char *)buf, buf_size, (sockaddr *)&addr, &addr_len);
+	int ret = 0;
+	if (rtsp->udp_sock.wait_readable(timeout_ms))
+		ret = rtsp->udp_sock.recvfrom((char *)buf, buf_size, (sockaddr *)&addr, &addr_len);
 
 	char rtcp_buf[RTCP_BUFFER_SIZE];
 	int rtcp_len = rtsp->rtcp_sock.recvfrom(rtcp_buf, RTCP_BUFFER_SIZE, (sockaddr *)&addr, &addr_len);
-	parse_rtcp(rtcp_buf, rtcp_len);
+	parse_rtcp(rtsp, rtcp_buf, rtcp_len);
 
 	// TODO: check ip
 
 	return ret;
 }
 
-static void rtsp_teardown() {
+static void rtsp_teardown(rtsp_client *rtsp) {
 	if(!rtsp->tcp_sock.is_valid()) {
 		return;
 	}
@@ -452,26 +607,37 @@ static void rtsp_teardown() {
 		ss << "Session: " << rtsp->session_id << "\r\n\r\n";
 		rtsp->tcp_sock.send(ss.str());
 
-		if (rtsp_handle() != RTSP_RESULT_OK) {
+		if (rtsp_handle(rtsp) != RTSP_RESULT_OK) {
 			libKodi->Log(LOG_ERROR, "Failed to teardown RTSP session");
 			return;
 		}
 	}
 }
 
-void rtsp_close()
+void rtsp_close(rtsp_client *rtsp)
 {
 	if(rtsp) {
-		rtsp_teardown();
+		rtsp_teardown(rtsp);
 		rtsp->tcp_sock.close();
 		rtsp->udp_sock.close();
 		rtsp->rtcp_sock.close();
+		free(rtsp->content_base);
+		free(rtsp->control);
 		delete rtsp;
-		rtsp = NULL;
 	}
 }
 
-void rtsp_fill_signal_status(PVR_SIGNAL_STATUS& signal_status) {
+bool rtsp_get_tuner_status(rtsp_client *rtsp, int& frontend, int& level, int& quality) {
+	if (!rtsp || rtsp->frontend == 0)
+		return false;
+
+	frontend = rtsp->frontend;
+	level = rtsp->level;
+	quality = rtsp->quality;
+	return true;
+}
+
+void rtsp_fill_signal_status(rtsp_client *rtsp, PVR_SIGNAL_STATUS& signal_status) {
 	if(rtsp) {
 		strncpy(signal_status.strServiceName, rtsp->name.c_str(), PVR_ADDON_NAME_STRING_LENGTH - 1);
 		signal_status.iSNR = 0x1111 * rtsp->quality;
@@ -2,11 +2,35 @@
 #define _RTSP_CLIENT_HPP_
 
 #include <string>
+#include <utility>
+#include <vector>
 #include <xbmc_pvr_types.h>
 
-bool rtsp_open(const std::string& name, const std::string& url_str);
-void rtsp_close();
-int rtsp_read(void *buf, unsigned buf_size);
-void rtsp_fill_signal_status(PVR_SIGNAL_STATUS& signal_status);
+struct rtsp_server_status {
+	/* Only updated if the server announces it */
+	int frontends;
+	int streams;
+	/* Frontend and frequency in MHz of every stream */
+	std::vector<std::pair<int, int> > tuned;
+};
+
+struct rtsp_client;
+
+/* Set up and play a stream, NULL on failure */
+rtsp_client *rtsp_open(const std::string& name, const std::string& url_str);
+void rtsp_close(rtsp_client *rtsp);
+/* Read one RTP packet, 0 if none arrived within timeout_ms */
+int rtsp_read(rtsp_client *rtsp, void *buf, unsigned buf_size, int timeout_ms);
+/* Change the PIDs of a playing stream, lists are comma separated */
+bool rtsp_update_pids(rtsp_client *rtsp, const std::string& addpids, const std::string& delpids);
+/* Keep the session from timing out, sends a request once the session's
+ * keepalive interval has passed */
+bool rtsp_keepalive(rtsp_client *rtsp);
+void rtsp_fill_signal_status(rtsp_client *rtsp, PVR_SIGNAL_STATUS& signal_status);
+/* Frontend, level and quality of a stream as last reported via RTCP, false
+ * if there was no report yet */
+bool rtsp_get_tuner_status(rtsp_client *rtsp, int& frontend, int& level, int& quality);
+/* Query the session state of the server behind url_str */
+bool rtsp_describe(const std::string& url_str, rtsp_server_status& status);
 
 #endif